@@ -0,0 +1,101 @@
+#include <atomic>
+#include <chrono>
+#include <iostream>
+#include <latch>
+#include <string>
+#include <thread>
+
+#include "coroutine_task.h"
+#include "thread_pool.h"
+
+// C++20协程版本的示例, 单独编译成CoroutineProject
+
+// 1. 协程版本的FetchDataFromDB(见future_sample.h): 等待"数据库"时协程挂起,
+// 工作线程可以去处理其他请求, 而不是sleep在那里
+task<std::string> fetch_data_from_db(ThreadPool& pool, std::string query) {
+  co_await sleep_for(pool, std::chrono::milliseconds(100));
+  co_return "Data: " + query;
+}
+
+// 协程之间直接co_await, 不需要future, 也不阻塞线程
+task<size_t> handle_request(ThreadPool& pool, int id) {
+  co_await schedule(pool);
+  std::string user =
+      co_await fetch_data_from_db(pool, "user " + std::to_string(id));
+  std::string orders =
+      co_await fetch_data_from_db(pool, "orders of " + user);
+  co_return orders.size();
+}
+
+void use_coroutine_task() {
+  ThreadPool pool(2);
+  size_t size = sync_wait(handle_request(pool, 1));
+  std::cout << "response size " << size << std::endl;
+}
+
+// 2. 2个工作线程同时处理1000个请求: 每个请求要等两次100ms的"IO",
+// 如果用sleep阻塞线程需要100秒, 协程挂起时不占用线程, 总耗时只比200ms多一点
+task<void> serve(ThreadPool& pool, int id, std::latch& done) {
+  co_await handle_request(pool, id);
+  done.count_down();
+}
+
+void use_coroutine_concurrency() {
+  const int kRequests = 1000;
+  ThreadPool pool(2);
+  std::latch done(kRequests);
+  auto start = std::chrono::steady_clock::now();
+  for (int i = 0; i < kRequests; ++i) {
+    spawn(pool, serve(pool, i, done));
+  }
+  done.wait();
+  std::chrono::duration<double, std::milli> cost =
+      std::chrono::steady_clock::now() - start;
+  std::cout << kRequests << " requests on " << pool.ThreadCount()
+            << " threads took " << cost.count() << "ms" << std::endl;
+}
+
+// 3. 协程中抛出的异常在co_await/sync_wait处重新抛出
+task<int> may_fail(ThreadPool& pool) {
+  co_await schedule(pool);
+  throw std::runtime_error("query failed");
+  co_return 0;
+}
+
+void use_coroutine_exception() {
+  ThreadPool pool(2);
+  try {
+    sync_wait(may_fail(pool));
+  } catch (const std::exception& e) {
+    std::cout << "caught: " << e.what() << std::endl;
+  }
+}
+
+// 4. 线程池关闭后sleep_for立刻抛出TaskCancelled, 协程捕获异常后可以重试,
+// 重试时再次sleep_for同样会被取消, 不会卡住
+task<int> retry_sleep(ThreadPool& pool, int attempts) {
+  int cancelled = 0;
+  for (int i = 0; i < attempts; ++i) {
+    try {
+      co_await sleep_for(pool, std::chrono::milliseconds(1));
+    } catch (const TaskCancelled&) {
+      ++cancelled;
+    }
+  }
+  co_return cancelled;
+}
+
+void use_coroutine_retry_after_cancel() {
+  ThreadPool pool(2);
+  pool.Shutdown();
+  std::cout << "cancelled " << sync_wait(retry_sleep(pool, 3))
+            << " sleeps after shutdown" << std::endl;
+}
+
+int main() {
+  use_coroutine_task();
+  // use_coroutine_concurrency();
+  // use_coroutine_exception();
+  // use_coroutine_retry_after_cancel();
+  return 0;
+}
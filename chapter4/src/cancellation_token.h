@@ -0,0 +1,46 @@
+#ifndef cancellation_token_h_
+#define cancellation_token_h_
+#include <atomic>
+#include <memory>
+
+// 协作式取消: CancellationSource发出取消请求, 持有对应CancellationToken的一方自己检查
+// 线程没有办法被安全地强行终止, 所以取消只是一个标记:
+// 1. 还在队列中的任务, 线程池取出时发现已取消就不再执行
+// 2. 正在执行的任务需要自己定期检查, 发现已取消时尽早返回
+// 同一个source可以发出多个token, 比如一个客户端请求拆分出的所有任务共用一个token,
+// 请求超时或断开时一次取消全部
+class CancellationToken {
+ public:
+  // 默认构造的token永远不会被取消, 检查它没有任何开销
+  CancellationToken() = default;
+
+  bool IsCancelled() const {
+    return state_ != nullptr && state_->load(std::memory_order_acquire);
+  }
+
+  bool CanBeCancelled() const { return state_ != nullptr; }
+
+ private:
+  friend class CancellationSource;
+  explicit CancellationToken(std::shared_ptr<std::atomic<bool>> state)
+      : state_(std::move(state)) {}
+
+  std::shared_ptr<std::atomic<bool>> state_;
+};
+
+class CancellationSource {
+ public:
+  CancellationSource() : state_(std::make_shared<std::atomic<bool>>(false)) {}
+
+  CancellationToken Token() const { return CancellationToken(state_); }
+
+  // 可以重复调用, 也可以在任意线程调用
+  void Cancel() { state_->store(true, std::memory_order_release); }
+
+  bool IsCancelled() const { return state_->load(std::memory_order_acquire); }
+
+ private:
+  std::shared_ptr<std::atomic<bool>> state_;
+};
+
+#endif  // cancellation_token_h_
@@ -0,0 +1,284 @@
+#ifndef coroutine_task_h_
+#define coroutine_task_h_
+#if !defined(__cpp_impl_coroutine)
+#error "coroutine_task.h requires C++20 coroutines"
+#endif
+#include <condition_variable>
+#include <coroutine>
+#include <exception>
+#include <mutex>
+#include <optional>
+#include <utility>
+
+#include "thread_pool.h"
+
+// 基于C++20协程的线程池执行器
+// 任务在等待IO、定时器时如果阻塞在sleep/get()上, 就一直占着一个工作线程,
+// 能同时处理的请求数不会超过线程数; 写成协程后, 等待时协程挂起, 工作线程去执行别的任务,
+// 等待结束后协程作为一个新任务重新提交给线程池, 从挂起的地方继续执行
+// 1. task<T>: 惰性启动的协程, 被co_await时才开始执行, 执行完后直接切换回等待它的协程
+//    (对称转移, symmetric transfer), 协程之间互相co_await不会阻塞任何线程
+// 2. co_await schedule(pool): 把当前协程转移到线程池上继续执行
+// 3. co_await sleep_for(pool, d): 挂起d时间, 由线程池的定时器唤醒, 期间不占用线程
+// 4. sync_wait(task): 在普通函数中阻塞等待协程的结果, 不应在线程池的工作线程中调用
+// 5. spawn(pool, task): 在线程池上启动一个协程, 不等待它的结果
+// 线程池关闭导致协程无法被唤醒时, co_await处抛出TaskCancelled异常
+
+template <typename T = void>
+class task;
+
+namespace task_detail {
+
+struct promise_base {
+  // 执行完成后, final_suspend切换到等待这个协程的协程; 没有时返回到resume的调用者
+  struct final_awaiter {
+    bool await_ready() noexcept { return false; }
+    template <typename Promise>
+    std::coroutine_handle<> await_suspend(
+        std::coroutine_handle<Promise> h) noexcept {
+      return h.promise().continuation;
+    }
+    void await_resume() noexcept {}
+  };
+
+  std::suspend_always initial_suspend() noexcept { return {}; }
+  final_awaiter final_suspend() noexcept { return {}; }
+  void unhandled_exception() { error = std::current_exception(); }
+
+  std::coroutine_handle<> continuation = std::noop_coroutine();
+  std::exception_ptr error;
+};
+
+template <typename T>
+struct promise : promise_base {
+  task<T> get_return_object();
+
+  template <typename U>
+  void return_value(U&& value) {
+    result.emplace(std::forward<U>(value));
+  }
+
+  T get() {
+    if (error) {
+      std::rethrow_exception(error);
+    }
+    return std::move(*result);
+  }
+
+  std::optional<T> result;
+};
+
+template <>
+struct promise<void> : promise_base {
+  task<void> get_return_object();
+  void return_void() {}
+
+  void get() {
+    if (error) {
+      std::rethrow_exception(error);
+    }
+  }
+};
+
+// 启动后不需要等待的协程, 执行完自动销毁; 内部用于sync_wait和spawn
+struct detached {
+  struct promise_type {
+    detached get_return_object() { return {}; }
+    std::suspend_never initial_suspend() noexcept { return {}; }
+    std::suspend_never final_suspend() noexcept { return {}; }
+    void return_void() {}
+    void unhandled_exception() { std::terminate(); }
+  };
+};
+
+}  // namespace task_detail
+
+template <typename T>
+class task {
+ public:
+  using promise_type = task_detail::promise<T>;
+  using handle_type = std::coroutine_handle<promise_type>;
+
+  task(task&& other) noexcept : h_(std::exchange(other.h_, nullptr)) {}
+  task& operator=(task&& other) noexcept {
+    if (this != &other) {
+      if (h_) {
+        h_.destroy();
+      }
+      h_ = std::exchange(other.h_, nullptr);
+    }
+    return *this;
+  }
+  task(const task&) = delete;
+  task& operator=(const task&) = delete;
+  ~task() {
+    if (h_) {
+      h_.destroy();
+    }
+  }
+
+  // co_await时才启动协程, 把自己登记为它的后续, 然后直接切换过去执行
+  auto operator co_await() noexcept {
+    struct awaiter {
+      handle_type h;
+      bool await_ready() noexcept { return false; }
+      std::coroutine_handle<> await_suspend(
+          std::coroutine_handle<> caller) noexcept {
+        h.promise().continuation = caller;
+        return h;
+      }
+      T await_resume() { return h.promise().get(); }
+    };
+    return awaiter{h_};
+  }
+
+ private:
+  friend struct task_detail::promise<T>;
+  template <typename U>
+  friend U sync_wait(task<U> t);
+
+  explicit task(handle_type h) : h_(h) {}
+
+  handle_type h_;
+};
+
+namespace task_detail {
+
+template <typename T>
+task<T> promise<T>::get_return_object() {
+  return task<T>(std::coroutine_handle<promise<T>>::from_promise(*this));
+}
+
+inline task<void> promise<void>::get_return_object() {
+  return task<void>(std::coroutine_handle<promise<void>>::from_promise(*this));
+}
+
+// 由线程池的任务唤醒协程的awaiter
+// 任务被线程池丢弃(关闭)时也要唤醒协程, 否则协程永远挂起, 这时在co_await处抛出异常
+// 唤醒可能发生在await_suspend返回之前(其他线程已经执行了任务, 或者提交时就被取消),
+// 所以await_suspend提交任务之后不能再访问awaiter自身
+class resume_awaiter {
+ public:
+  bool await_ready() noexcept { return false; }
+  void await_resume() {
+    if (error_) {
+      std::rethrow_exception(error_);
+    }
+  }
+
+ protected:
+  struct resume_task {
+    std::coroutine_handle<> h;
+    resume_awaiter* awaiter;
+
+    void operator()() { h.resume(); }
+    void cancel(std::exception_ptr error) {
+      awaiter->error_ = error;
+      h.resume();
+    }
+  };
+
+  std::exception_ptr error_;
+};
+
+class schedule_awaiter : public resume_awaiter {
+ public:
+  schedule_awaiter(ThreadPool& pool, TaskPriority priority)
+      : pool_(pool), priority_(priority) {}
+
+  void await_suspend(std::coroutine_handle<> h) {
+    pool_.Execute(ThreadPool::Task(resume_task{h, this}), priority_);
+  }
+
+ private:
+  ThreadPool& pool_;
+  TaskPriority priority_;
+};
+
+class sleep_awaiter : public resume_awaiter {
+ public:
+  sleep_awaiter(ThreadPool& pool, std::chrono::nanoseconds duration)
+      : pool_(pool), duration_(duration) {}
+
+  bool await_ready() noexcept { return duration_.count() <= 0; }
+
+  void await_suspend(std::coroutine_handle<> h) {
+    pool_.ScheduleAfter(duration_, resume_task{h, this});
+  }
+
+ private:
+  ThreadPool& pool_;
+  std::chrono::nanoseconds duration_;
+};
+
+struct sync_state {
+  std::mutex mtx;
+  std::condition_variable cv;
+  bool done = false;
+};
+
+// 等待t执行完(不取结果), 再通知sync_wait; 通知在持有锁时完成,
+// sync_wait返回、sync_state析构时这里已经不再访问它
+template <typename T>
+detached notify_when_done(std::coroutine_handle<promise<T>> h,
+                          sync_state& state) {
+  struct awaiter {
+    std::coroutine_handle<promise<T>> h;
+    bool await_ready() noexcept { return false; }
+    std::coroutine_handle<> await_suspend(
+        std::coroutine_handle<> caller) noexcept {
+      h.promise().continuation = caller;
+      return h;
+    }
+    void await_resume() noexcept {}
+  };
+  co_await awaiter{h};
+  std::lock_guard<std::mutex> lock(state.mtx);
+  state.done = true;
+  state.cv.notify_all();
+}
+
+// 线程池关闭导致协程没有执行完时直接结束, 其他异常调用std::terminate
+template <typename T>
+detached run_detached(ThreadPool& pool, task<T> t) {
+  try {
+    co_await schedule_awaiter(pool, TaskPriority::kNormal);
+    co_await std::move(t);
+  } catch (const TaskCancelled&) {
+  }
+}
+
+}  // namespace task_detail
+
+// 把当前协程转移到线程池的工作线程上继续执行
+inline task_detail::schedule_awaiter schedule(
+    ThreadPool& pool, TaskPriority priority = TaskPriority::kNormal) {
+  return task_detail::schedule_awaiter(pool, priority);
+}
+
+// 挂起一段时间后在线程池上继续执行, 用来代替协程中的std::this_thread::sleep_for
+template <class Rep, class Period>
+task_detail::sleep_awaiter sleep_for(ThreadPool& pool,
+                                     std::chrono::duration<Rep, Period> d) {
+  return task_detail::sleep_awaiter(
+      pool, std::chrono::duration_cast<std::chrono::nanoseconds>(d));
+}
+
+// 在当前线程启动协程并阻塞等待它的结果, 协程抛出的异常在这里重新抛出
+template <typename T>
+T sync_wait(task<T> t) {
+  task_detail::sync_state state;
+  task_detail::notify_when_done(t.h_, state);
+  std::unique_lock<std::mutex> lock(state.mtx);
+  state.cv.wait(lock, [&state]() { return state.done; });
+  return t.h_.promise().get();
+}
+
+// 在线程池上启动协程, 不等待结果; 协程抛出的异常(线程池关闭时的TaskCancelled除外)
+// 会调用std::terminate, 和ThreadPool::Post一样
+template <typename T>
+void spawn(ThreadPool& pool, task<T> t) {
+  task_detail::run_detached(pool, std::move(t));
+}
+
+#endif  // coroutine_task_h_
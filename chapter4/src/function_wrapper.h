@@ -0,0 +1,136 @@
+#ifndef function_wrapper_h_
+#define function_wrapper_h_
+#include <cstddef>
+#include <exception>
+#include <new>
+#include <type_traits>
+#include <utility>
+
+// 只能移动的类型擦除任务, 用来代替线程池中的std::packaged_task<void()>
+// std::function要求可调用对象可拷贝, 不能存放std::packaged_task/std::promise这类
+// 只能移动的对象; std::packaged_task<void()>每次构造都要在堆上分配共享状态
+// 这里参考std::function的小对象优化(small buffer optimization):
+// 1. 可调用对象不超过kInlineSize且移动构造不抛异常时, 直接构造在对象内部的缓冲区里,
+//    不需要任何堆内存分配
+// 2. 否则才在堆上new一个, 缓冲区里只存放它的指针
+// 通过一张静态的函数表(调用/移动/析构)擦除具体类型, 相当于手写的虚函数
+class function_wrapper {
+ public:
+  static constexpr std::size_t kInlineSize = 56;
+
+  function_wrapper() = default;
+
+  template <typename F,
+            typename = std::enable_if_t<
+                !std::is_same<std::decay_t<F>, function_wrapper>::value>>
+  function_wrapper(F&& f) {
+    using Fn = std::decay_t<F>;
+    if constexpr (stored_inline<Fn>()) {
+      ::new (static_cast<void*>(&storage_)) Fn(std::forward<F>(f));
+      ops_ = &inline_ops<Fn>;
+    } else {
+      ::new (static_cast<void*>(&storage_)) Fn*(new Fn(std::forward<F>(f)));
+      ops_ = &heap_ops<Fn>;
+    }
+  }
+
+  function_wrapper(function_wrapper&& other) noexcept { move_from(other); }
+
+  function_wrapper& operator=(function_wrapper&& other) noexcept {
+    if (this != &other) {
+      reset();
+      move_from(other);
+    }
+    return *this;
+  }
+
+  function_wrapper(const function_wrapper&) = delete;
+  function_wrapper& operator=(const function_wrapper&) = delete;
+
+  ~function_wrapper() { reset(); }
+
+  void operator()() { ops_->call(&storage_); }
+
+  // 任务没有执行就被丢弃时调用: 可调用对象如果有cancel(std::exception_ptr)成员函数
+  // (比如带promise的任务), 就把异常交给它, 让等待结果的一方收到取消的通知;
+  // 否则什么也不做
+  void cancel(std::exception_ptr error) { ops_->cancel(&storage_, error); }
+
+  explicit operator bool() const { return ops_ != nullptr; }
+
+ private:
+  struct ops {
+    void (*call)(void*);
+    void (*move)(void* dst, void* src);  // 移动构造到dst, 并析构src
+    void (*destroy)(void*);
+    void (*cancel)(void*, std::exception_ptr);
+  };
+
+  template <typename Fn, typename = void>
+  struct has_cancel : std::false_type {};
+  template <typename Fn>
+  struct has_cancel<Fn, std::void_t<decltype(std::declval<Fn&>().cancel(
+                            std::declval<std::exception_ptr>()))>>
+      : std::true_type {};
+
+  template <typename Fn>
+  static void cancel_fn(Fn& fn, std::exception_ptr error) {
+    if constexpr (has_cancel<Fn>::value) {
+      fn.cancel(error);
+    } else {
+      (void)fn;
+      (void)error;
+    }
+  }
+
+  template <typename Fn>
+  static constexpr bool stored_inline() {
+    return sizeof(Fn) <= kInlineSize &&
+           alignof(Fn) <= alignof(std::max_align_t) &&
+           std::is_nothrow_move_constructible<Fn>::value;
+  }
+
+  template <typename Fn>
+  static constexpr ops inline_ops = {
+      [](void* p) { (*static_cast<Fn*>(p))(); },
+      [](void* dst, void* src) {
+        ::new (dst) Fn(std::move(*static_cast<Fn*>(src)));
+        static_cast<Fn*>(src)->~Fn();
+      },
+      [](void* p) { static_cast<Fn*>(p)->~Fn(); },
+      [](void* p, std::exception_ptr error) {
+        cancel_fn(*static_cast<Fn*>(p), error);
+      }};
+
+  // 堆上的对象移动时只需要转移指针
+  template <typename Fn>
+  static constexpr ops heap_ops = {
+      [](void* p) { (**static_cast<Fn**>(p))(); },
+      [](void* dst, void* src) {
+        ::new (dst) Fn*(*static_cast<Fn**>(src));
+      },
+      [](void* p) { delete *static_cast<Fn**>(p); },
+      [](void* p, std::exception_ptr error) {
+        cancel_fn(**static_cast<Fn**>(p), error);
+      }};
+
+  void move_from(function_wrapper& other) noexcept {
+    if (other.ops_ != nullptr) {
+      other.ops_->move(&storage_, &other.storage_);
+      ops_ = other.ops_;
+      other.ops_ = nullptr;
+    }
+  }
+
+  void reset() {
+    if (ops_ != nullptr) {
+      ops_->destroy(&storage_);
+      ops_ = nullptr;
+    }
+  }
+
+  alignas(std::max_align_t) unsigned char storage_[kInlineSize];
+  const ops* ops_ = nullptr;
+};
+
+#endif  // function_wrapper_h_
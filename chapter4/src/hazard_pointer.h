@@ -0,0 +1,153 @@
+#ifndef hazard_pointer_h_
+#define hazard_pointer_h_
+#include <algorithm>
+#include <atomic>
+#include <cstddef>
+#include <mutex>
+#include <stdexcept>
+#include <vector>
+
+// 风险指针(hazard pointer), 用于无锁数据结构中节点的安全回收
+// 无锁队列中一个线程把节点摘下来之后, 其他线程可能刚读到这个节点的指针、正要访问它,
+// 这时直接delete会导致访问已释放的内存(或者ABA问题)
+// 1. 每个线程有kSlotsPerThread个风险指针槽位, 访问节点前先把指针写入槽位,
+//    再确认它仍然可达(protect), 之后其他线程就不会释放这个节点
+// 2. 摘下的节点不立即释放, 而是放入当前线程的待回收列表(retire);
+//    列表长度达到kScanThreshold时扫描所有线程的槽位, 只释放没有被任何槽位引用的节点
+// 3. 每次扫描后仍被引用的节点不超过槽位总数kMaxThreads * kSlotsPerThread, 所以待回收的
+//    节点数有上界, 长时间运行时内存不会持续增长; 线程退出时剩余的节点交给全局列表,
+//    由其他线程下次扫描时回收
+// 最多支持kMaxThreads个线程同时使用, 超出时抛出std::runtime_error
+class hazard_pointer_domain {
+ public:
+  static constexpr int kMaxThreads = 128;
+  static constexpr int kSlotsPerThread = 2;
+  static constexpr size_t kScanThreshold = 2 * kMaxThreads * kSlotsPerThread;
+
+  static hazard_pointer_domain& instance() {
+    static hazard_pointer_domain domain;
+    return domain;
+  }
+
+  ~hazard_pointer_domain() {
+    for (auto& r : orphans) {
+      r.deleter(r.ptr);
+    }
+  }
+
+  // 把src当前指向的节点写入当前线程的第index个槽位并返回它
+  // 写入后要重新读取src确认节点仍然可达: 如果在读取和写入槽位之间节点被摘下并扫描过,
+  // 这个槽位就没能保护它, 需要重试
+  template <typename T>
+  static T* protect(int index, const std::atomic<T*>& src) {
+    std::atomic<void*>& slot = local().rec->slots[index];
+    T* p = src.load();
+    for (;;) {
+      slot.store(p);
+      T* current = src.load();
+      if (current == p) {
+        return p;
+      }
+      p = current;
+    }
+  }
+
+  // 直接设置槽位, 调用方需要自己确认节点在设置之后仍然可达
+  static void set(int index, void* p) { local().rec->slots[index].store(p); }
+
+  static void clear(int index) { set(index, nullptr); }
+
+  // 节点已经从数据结构中摘下, 等到没有槽位引用它时再delete
+  template <typename T>
+  static void retire(T* p) {
+    thread_state& state = local();
+    state.retired.push_back({p, [](void* q) { delete static_cast<T*>(q); }});
+    if (state.retired.size() >= kScanThreshold) {
+      instance().scan(state.retired);
+    }
+  }
+
+ private:
+  struct alignas(64) record {
+    std::atomic<bool> active{false};
+    std::atomic<void*> slots[kSlotsPerThread] = {};
+  };
+
+  struct retired_node {
+    void* ptr;
+    void (*deleter)(void*);
+  };
+
+  // 线程第一次使用时占用一个record, 线程退出时释放
+  struct thread_state {
+    hazard_pointer_domain& domain = instance();
+    record* rec = domain.acquire();
+    std::vector<retired_node> retired;
+
+    ~thread_state() {
+      for (auto& slot : rec->slots) {
+        slot.store(nullptr);
+      }
+      domain.scan(retired);
+      domain.adopt_orphans(retired);
+      rec->active.store(false);
+    }
+  };
+
+  static thread_state& local() {
+    thread_local thread_state state;
+    return state;
+  }
+
+  record* acquire() {
+    for (auto& r : records) {
+      bool expected = false;
+      if (!r.active.load(std::memory_order_relaxed) &&
+          r.active.compare_exchange_strong(expected, true)) {
+        return &r;
+      }
+    }
+    throw std::runtime_error("hazard_pointer_domain: too many threads");
+  }
+
+  // 释放retired中没有被任何槽位引用的节点, 其余的留在列表中
+  void scan(std::vector<retired_node>& retired) {
+    {
+      std::lock_guard<std::mutex> lock(orphan_mtx);
+      if (!orphans.empty()) {
+        retired.insert(retired.end(), orphans.begin(), orphans.end());
+        orphans.clear();
+      }
+    }
+    std::vector<void*> hazards;
+    for (auto& r : records) {
+      for (auto& slot : r.slots) {
+        if (void* p = slot.load()) {
+          hazards.push_back(p);
+        }
+      }
+    }
+    std::sort(hazards.begin(), hazards.end());
+    auto keep = std::partition(
+        retired.begin(), retired.end(), [&hazards](const retired_node& r) {
+          return std::binary_search(hazards.begin(), hazards.end(), r.ptr);
+        });
+    for (auto it = keep; it != retired.end(); ++it) {
+      it->deleter(it->ptr);
+    }
+    retired.erase(keep, retired.end());
+  }
+
+  // 线程退出时仍被引用的节点交给其他线程回收
+  void adopt_orphans(std::vector<retired_node>& retired) {
+    std::lock_guard<std::mutex> lock(orphan_mtx);
+    orphans.insert(orphans.end(), retired.begin(), retired.end());
+    retired.clear();
+  }
+
+  record records[kMaxThreads];
+  std::mutex orphan_mtx;
+  std::vector<retired_node> orphans;
+};
+
+#endif  // hazard_pointer_h_
@@ -0,0 +1,142 @@
+#ifndef latency_histogram_h_
+#define latency_histogram_h_
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+
+// 记录耗时分布的直方图, 单位是纳秒, 用来统计任务排队时间、执行时间的p50/p99等
+// 分桶方式类似HdrHistogram: 小于16ns的值每个值一个桶, 之后每个2的幂次区间
+// [2^e, 2^(e+1))再平均分成8个桶, 所以统计出的分位数相对误差不超过1/8
+// 桶计数都是原子变量并用relaxed内存序累加, 多个线程可以同时Record,
+// 读取时得到的是一个近似的快照, 对统计用途来说足够了
+class LatencyHistogram {
+ public:
+  static constexpr int kSubBucketBits = 3;
+  static constexpr int kSubBucketNum = 1 << kSubBucketBits;  // 8
+  static constexpr int kLinearNum = 2 * kSubBucketNum;       // 16
+  static constexpr int kBucketNum =
+      kLinearNum + (64 - kSubBucketBits - 1) * kSubBucketNum;
+
+  LatencyHistogram() = default;
+  LatencyHistogram(const LatencyHistogram& other) { Merge(other); }
+  LatencyHistogram& operator=(const LatencyHistogram& other) {
+    if (this != &other) {
+      Reset();
+      Merge(other);
+    }
+    return *this;
+  }
+
+  void Record(uint64_t ns) {
+    buckets_[BucketIndex(ns)].fetch_add(1, std::memory_order_relaxed);
+    count_.fetch_add(1, std::memory_order_relaxed);
+    sum_.fetch_add(ns, std::memory_order_relaxed);
+    uint64_t old_max = max_.load(std::memory_order_relaxed);
+    while (ns > old_max &&
+           !max_.compare_exchange_weak(old_max, ns, std::memory_order_relaxed)) {
+    }
+  }
+
+  template <typename Rep, typename Period>
+  void Record(std::chrono::duration<Rep, Period> d) {
+    auto ns = std::chrono::duration_cast<std::chrono::nanoseconds>(d).count();
+    Record(static_cast<uint64_t>(ns < 0 ? 0 : ns));
+  }
+
+  // 把另一个直方图的数据累加进来, 用于合并每个线程各自记录的数据
+  void Merge(const LatencyHistogram& other) {
+    for (int i = 0; i < kBucketNum; ++i) {
+      uint64_t n = other.buckets_[i].load(std::memory_order_relaxed);
+      if (n != 0) {
+        buckets_[i].fetch_add(n, std::memory_order_relaxed);
+      }
+    }
+    count_.fetch_add(other.Count(), std::memory_order_relaxed);
+    sum_.fetch_add(other.Sum(), std::memory_order_relaxed);
+    uint64_t other_max = other.Max();
+    uint64_t old_max = max_.load(std::memory_order_relaxed);
+    while (other_max > old_max &&
+           !max_.compare_exchange_weak(old_max, other_max,
+                                       std::memory_order_relaxed)) {
+    }
+  }
+
+  void Reset() {
+    for (auto& bucket : buckets_) {
+      bucket.store(0, std::memory_order_relaxed);
+    }
+    count_.store(0, std::memory_order_relaxed);
+    sum_.store(0, std::memory_order_relaxed);
+    max_.store(0, std::memory_order_relaxed);
+  }
+
+  uint64_t Count() const { return count_.load(std::memory_order_relaxed); }
+  uint64_t Sum() const { return sum_.load(std::memory_order_relaxed); }
+  uint64_t Max() const { return max_.load(std::memory_order_relaxed); }
+  double Mean() const {
+    uint64_t n = Count();
+    return n == 0 ? 0.0 : static_cast<double>(Sum()) / n;
+  }
+
+  // 第p百分位的耗时(p取0~100), 返回所在桶的上界, 不会超过记录到的最大值
+  uint64_t Percentile(double p) const {
+    uint64_t total = 0;
+    for (const auto& bucket : buckets_) {
+      total += bucket.load(std::memory_order_relaxed);
+    }
+    if (total == 0) {
+      return 0;
+    }
+    uint64_t rank = static_cast<uint64_t>(p / 100.0 * total + 0.5);
+    rank = rank < 1 ? 1 : (rank > total ? total : rank);
+    uint64_t seen = 0;
+    for (int i = 0; i < kBucketNum; ++i) {
+      seen += buckets_[i].load(std::memory_order_relaxed);
+      if (seen >= rank) {
+        uint64_t upper = BucketUpperBound(i);
+        uint64_t max = Max();
+        return upper < max ? upper : max;
+      }
+    }
+    return Max();
+  }
+
+ private:
+  static int HighestBit(uint64_t v) {
+#if defined(__GNUC__)
+    return 63 - __builtin_clzll(v);
+#else
+    int bit = 0;
+    while (v >>= 1) {
+      ++bit;
+    }
+    return bit;
+#endif
+  }
+
+  static int BucketIndex(uint64_t v) {
+    if (v < static_cast<uint64_t>(kLinearNum)) {
+      return static_cast<int>(v);
+    }
+    int e = HighestBit(v);  // e >= 4
+    int sub = static_cast<int>((v >> (e - kSubBucketBits)) & (kSubBucketNum - 1));
+    return kLinearNum + (e - kSubBucketBits - 1) * kSubBucketNum + sub;
+  }
+
+  static uint64_t BucketUpperBound(int index) {
+    if (index < kLinearNum) {
+      return static_cast<uint64_t>(index);
+    }
+    int e = (index - kLinearNum) / kSubBucketNum + kSubBucketBits + 1;
+    uint64_t sub = (index - kLinearNum) % kSubBucketNum;
+    uint64_t width = uint64_t(1) << (e - kSubBucketBits);
+    return ((kSubBucketNum + sub) << (e - kSubBucketBits)) + width - 1;
+  }
+
+  std::atomic<uint64_t> buckets_[kBucketNum]{};
+  std::atomic<uint64_t> count_{0};
+  std::atomic<uint64_t> sum_{0};
+  std::atomic<uint64_t> max_{0};
+};
+
+#endif  // latency_histogram_h_
@@ -0,0 +1,149 @@
+#ifndef lock_free_queue_h_
+#define lock_free_queue_h_
+#include <atomic>
+#include <memory>
+#include <new>
+#include <thread>
+#include <utility>
+
+#include "hazard_pointer.h"
+
+// 无界的无锁多生产者多消费者队列, 基于Michael-Scott算法, 接口与threadsafe_queue兼容
+// threadsafe_queue在线程数很多时所有线程都排队等同一把锁, 持锁的线程被调度出去后其他线程
+// 全部停滞; 无锁队列中总有一个线程的CAS能成功, 整体一定在前进
+// 1. 和threadsafe_list_queue一样是带虚拟节点的单链表, head指向虚拟节点,
+//    head->next才是队首元素; 入队CAS修改tail->next, 出队CAS修改head
+// 2. 入队分两步: 先把新节点挂到tail->next上, 再把tail后移; 其他线程看到tail->next
+//    不为空时帮忙后移tail, 所以不会因为某个线程在两步之间停住而阻塞其他线程
+// 3. 出队后旧的虚拟节点通过风险指针(hazard_pointer.h)延迟释放, 其他线程可能还在读它的next
+// 没有元素时无法挂起等待, wait_and_pop只能自旋并让出时间片, 适合消费者一直很忙的场景
+template <typename T>
+class lock_free_queue {
+ private:
+  struct node {
+    std::atomic<node*> next{nullptr};
+    alignas(T) unsigned char storage[sizeof(T)];  // 虚拟节点中没有元素
+
+    T* value() { return std::launder(reinterpret_cast<T*>(storage)); }
+  };
+
+  alignas(64) std::atomic<node*> head;
+  alignas(64) std::atomic<node*> tail;
+
+  // 把队首元素移交给take, 队列为空时返回false
+  // 元素所在的节点成为新的虚拟节点, 元素本身在这里析构
+  template <typename Fn>
+  bool pop_front(Fn take) {
+    using hp = hazard_pointer_domain;
+    for (;;) {
+      node* old_head = hp::protect(0, head);
+      node* old_tail = tail.load();
+      node* next = old_head->next.load();
+      // next可能正在被其他线程出队并释放, 设置槽位后确认head没变, next就还没有被摘下
+      hp::set(1, next);
+      if (old_head != head.load()) {
+        continue;
+      }
+      if (next == nullptr) {
+        hp::clear(0);
+        hp::clear(1);
+        return false;
+      }
+      if (old_head == old_tail) {
+        // tail落后了, 帮忙后移
+        tail.compare_exchange_strong(old_tail, next);
+        continue;
+      }
+      if (head.compare_exchange_strong(old_head, next)) {
+        // 只有CAS成功的线程会访问next中的元素
+        take(std::move(*next->value()));
+        next->value()->~T();
+        hp::clear(0);
+        hp::clear(1);
+        hp::retire(old_head);
+        return true;
+      }
+    }
+  }
+
+ public:
+  lock_free_queue() {
+    node* dummy = new node;
+    head.store(dummy);
+    tail.store(dummy);
+  }
+  lock_free_queue(const lock_free_queue&) = delete;
+  lock_free_queue& operator=(const lock_free_queue&) = delete;
+
+  // 析构时不能有其他线程还在访问队列
+  ~lock_free_queue() {
+    node* p = head.load();
+    node* next = p->next.load();
+    delete p;
+    while (next != nullptr) {
+      p = next;
+      next = p->next.load();
+      p->value()->~T();
+      delete p;
+    }
+  }
+
+  bool empty() const {
+    // head节点可能被其他线程出队后释放, 读取它的next前同样要用风险指针保护
+    using hp = hazard_pointer_domain;
+    node* h = hp::protect(0, head);
+    bool res = h->next.load() == nullptr;
+    hp::clear(0);
+    return res;
+  }
+
+  void push(T new_value) {
+    using hp = hazard_pointer_domain;
+    node* n = new node;
+    new (n->storage) T(std::move(new_value));
+    for (;;) {
+      node* old_tail = hp::protect(0, tail);
+      node* next = old_tail->next.load();
+      if (old_tail != tail.load()) {
+        continue;
+      }
+      if (next != nullptr) {
+        // 其他线程挂上了节点但还没后移tail, 帮它完成
+        tail.compare_exchange_weak(old_tail, next);
+        continue;
+      }
+      if (old_tail->next.compare_exchange_weak(next, n)) {
+        // 失败说明已经有其他线程帮忙后移了tail
+        tail.compare_exchange_strong(old_tail, n);
+        break;
+      }
+    }
+    hp::clear(0);
+  }
+
+  bool try_pop(T& value) {
+    return pop_front([&value](T&& v) { value = std::move(v); });
+  }
+
+  std::shared_ptr<T> try_pop() {
+    std::shared_ptr<T> res;
+    pop_front([&res](T&& v) { res = std::make_shared<T>(std::move(v)); });
+    return res;
+  }
+
+  void wait_and_pop(T& value) {
+    while (!try_pop(value)) {
+      std::this_thread::yield();
+    }
+  }
+
+  std::shared_ptr<T> wait_and_pop() {
+    std::shared_ptr<T> res;
+    while ((res = try_pop()) == nullptr) {
+      std::this_thread::yield();
+    }
+    return res;
+  }
+};
+
+#endif  // lock_free_queue_h_
@@ -0,0 +1,104 @@
+#ifndef mpmc_bounded_queue_h_
+#define mpmc_bounded_queue_h_
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <stdexcept>
+#include <utility>
+
+// 有界的无锁多生产者多消费者(MPMC)环形队列, 参考Dmitry Vyukov的实现
+// 1. 容量固定为2的幂次, 用 位置 & mask 代替取模, 队列满时push直接返回false,
+//    由调用者决定是等待还是丢弃, 内存不会无限增长
+// 2. 每个槽位(cell)带一个序号sequence, 用来判断槽位当前的状态:
+//    sequence == pos       槽位空闲, 可以写入第pos个元素
+//    sequence == pos + 1   第pos个元素已写入, 可以读取
+//    读取完成后sequence置为pos + capacity, 表示可以写入下一轮的元素
+// 3. 生产者和消费者分别用CAS抢占enqueue_pos_/dequeue_pos_, 抢到位置后再读写槽位,
+//    通过sequence的acquire/release保证数据的可见性, 整个过程不需要互斥锁
+template <typename T>
+class mpmc_bounded_queue {
+ private:
+  struct cell {
+    std::atomic<size_t> sequence;
+    T data;
+  };
+
+  // 两个位置放在不同的缓存行上, 避免生产者和消费者之间的伪共享
+  std::unique_ptr<cell[]> buffer;
+  size_t mask;
+  alignas(64) std::atomic<size_t> enqueue_pos{0};
+  alignas(64) std::atomic<size_t> dequeue_pos{0};
+
+ public:
+  explicit mpmc_bounded_queue(size_t capacity) {
+    if (capacity < 2 || (capacity & (capacity - 1)) != 0) {
+      throw std::invalid_argument("capacity must be a power of two");
+    }
+    buffer.reset(new cell[capacity]);
+    mask = capacity - 1;
+    for (size_t i = 0; i < capacity; ++i) {
+      buffer[i].sequence.store(i, std::memory_order_relaxed);
+    }
+  }
+  mpmc_bounded_queue(const mpmc_bounded_queue&) = delete;
+  mpmc_bounded_queue& operator=(const mpmc_bounded_queue&) = delete;
+
+  size_t capacity() const { return mask + 1; }
+
+  // 队列满时返回false, 此时即使传入的是右值, value也不会被移走
+  template <typename U>
+  bool try_push(U&& value) {
+    cell* c;
+    size_t pos = enqueue_pos.load(std::memory_order_relaxed);
+    for (;;) {
+      c = &buffer[pos & mask];
+      size_t seq = c->sequence.load(std::memory_order_acquire);
+      intptr_t diff = static_cast<intptr_t>(seq) - static_cast<intptr_t>(pos);
+      if (diff == 0) {
+        // 槽位空闲, 尝试占用这个位置
+        if (enqueue_pos.compare_exchange_weak(pos, pos + 1,
+                                              std::memory_order_relaxed)) {
+          break;
+        }
+      } else if (diff < 0) {
+        // 槽位中还是上一轮没被读走的元素, 队列已满
+        return false;
+      } else {
+        // 位置已被其他生产者占用, 重新读取
+        pos = enqueue_pos.load(std::memory_order_relaxed);
+      }
+    }
+    c->data = std::forward<U>(value);
+    c->sequence.store(pos + 1, std::memory_order_release);
+    return true;
+  }
+
+  bool try_pop(T& value) {
+    cell* c;
+    size_t pos = dequeue_pos.load(std::memory_order_relaxed);
+    for (;;) {
+      c = &buffer[pos & mask];
+      size_t seq = c->sequence.load(std::memory_order_acquire);
+      intptr_t diff =
+          static_cast<intptr_t>(seq) - static_cast<intptr_t>(pos + 1);
+      if (diff == 0) {
+        if (dequeue_pos.compare_exchange_weak(pos, pos + 1,
+                                              std::memory_order_relaxed)) {
+          break;
+        }
+      } else if (diff < 0) {
+        // 槽位还没有写入, 队列为空
+        return false;
+      } else {
+        pos = dequeue_pos.load(std::memory_order_relaxed);
+      }
+    }
+    value = std::move(c->data);
+    c->data = T();  // 尽早释放元素持有的资源
+    c->sequence.store(pos + mask + 1, std::memory_order_release);
+    return true;
+  }
+};
+
+#endif  // mpmc_bounded_queue_h_
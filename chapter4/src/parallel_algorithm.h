@@ -0,0 +1,132 @@
+#ifndef parallel_algorithm_h_
+#define parallel_algorithm_h_
+#include <algorithm>
+#include <atomic>
+#include <cstddef>
+#include <iterator>
+#include <mutex>
+#include <utility>
+#include <vector>
+
+#include "task_group.h"
+#include "thread_pool.h"
+
+// 在常驻的线程池上执行的parallel_for/parallel_reduce
+// chapter2中的parallel_accumulate每次调用都要创建、join一批std::thread,
+// 并且按线程数把数据切成等长的块: 数据量不大时创建线程的开销比计算还大,
+// 每个元素耗时不均匀时, 分到耗时块的线程最后完成, 其他线程只能干等
+// 这里的做法:
+// 1. 任务都提交给线程池, 循环中反复调用也不会创建线程
+// 2. 按guided方式自适应分块: 所有参与的线程共享一个下标, 每次取走
+//    剩余元素数 / (2 * 参与线程数) 个元素(不少于grain个), 开始时块大、调度次数少,
+//    越到最后块越小, 先做完的线程会继续取剩下的小块, 负载自然均衡
+// 3. 调用线程自己也参与计算, 然后在TaskGroup::Wait中汇合
+
+namespace parallel_detail {
+
+// 把[0, n)分块, 对每一块调用chunk_fn(begin, end), 块的执行顺序不确定
+template <typename ChunkFn>
+void for_each_chunk(ThreadPool& pool, size_t n, size_t grain,
+                    ChunkFn chunk_fn) {
+  grain = std::max<size_t>(grain, 1);
+  // 工作线程中调用时, 当前线程本身就占用了一个工作线程
+  size_t runners = pool.ThreadCount() + (pool.InWorkerThread() ? 0 : 1);
+  runners = std::min(runners, (n + grain - 1) / grain);
+  if (runners <= 1) {
+    if (n > 0) {
+      chunk_fn(size_t(0), n);
+    }
+    return;
+  }
+
+  std::atomic<size_t> next{0};
+  TaskGroup group(pool);
+  auto runner = [&]() {
+    while (!group.IsCancelled()) {
+      size_t begin = next.load(std::memory_order_relaxed);
+      size_t end;
+      do {
+        if (begin >= n) {
+          return;
+        }
+        size_t remaining = n - begin;
+        size_t chunk = std::max(grain, remaining / (2 * runners));
+        end = begin + std::min(chunk, remaining);
+      } while (!next.compare_exchange_weak(begin, end,
+                                           std::memory_order_relaxed));
+      chunk_fn(begin, end);
+    }
+  };
+  for (size_t i = 1; i < runners; ++i) {
+    group.Run(runner);
+  }
+  try {
+    runner();
+  } catch (...) {
+    // 其他子任务不再取新的块, group析构时等它们退出
+    group.Cancel();
+    throw;
+  }
+  group.Wait();
+}
+
+}  // namespace parallel_detail
+
+// 对[first, last)中的每个下标i调用f(i), 不保证执行顺序
+// grain是每块的最小元素数, 每个元素耗时很短时调大可以减少调度开销
+// f抛出异常时, 剩余的块不再执行, 异常在调用线程中重新抛出
+template <typename Index, typename F>
+void parallel_for(ThreadPool& pool, Index first, Index last, F f,
+                  size_t grain = 1) {
+  if (!(first < last)) {
+    return;
+  }
+  size_t n = static_cast<size_t>(last - first);
+  auto chunk_fn = [&](size_t begin, size_t end) {
+    for (size_t i = begin; i < end; ++i) {
+      f(static_cast<Index>(first + i));
+    }
+  };
+  parallel_detail::for_each_chunk(pool, n, grain, chunk_fn);
+}
+
+template <typename Index, typename F>
+void parallel_for(Index first, Index last, F f, size_t grain = 1) {
+  parallel_for(ThreadPool::instance(), first, last, std::move(f), grain);
+}
+
+// 用op把[first, last)归约到init上, 要求迭代器支持随机访问
+// 每一块先在块内归约, 最后按块的先后顺序依次合并, 所以op只需要满足结合律,
+// 不需要满足交换律; 和parallel_accumulate一样, 浮点数的结果可能和串行计算略有不同
+template <typename RandomIt, typename T, typename BinaryOp>
+T parallel_reduce(ThreadPool& pool, RandomIt first, RandomIt last, T init,
+                  BinaryOp op, size_t grain = 1) {
+  size_t n = static_cast<size_t>(std::distance(first, last));
+  // 块数是O(线程数 * log(n / grain))级别, 加锁收集结果的开销可以忽略
+  std::vector<std::pair<size_t, T>> partials;
+  std::mutex mtx;
+  auto chunk_fn = [&](size_t begin, size_t end) {
+    T sum = *(first + begin);
+    for (size_t i = begin + 1; i < end; ++i) {
+      sum = op(std::move(sum), *(first + i));
+    }
+    std::lock_guard<std::mutex> lock(mtx);
+    partials.emplace_back(begin, std::move(sum));
+  };
+  parallel_detail::for_each_chunk(pool, n, grain, chunk_fn);
+  std::sort(partials.begin(), partials.end(),
+            [](const auto& a, const auto& b) { return a.first < b.first; });
+  for (auto& partial : partials) {
+    init = op(std::move(init), std::move(partial.second));
+  }
+  return init;
+}
+
+template <typename RandomIt, typename T, typename BinaryOp>
+T parallel_reduce(RandomIt first, RandomIt last, T init, BinaryOp op,
+                  size_t grain = 1) {
+  return parallel_reduce(ThreadPool::instance(), first, last, std::move(init),
+                         std::move(op), grain);
+}
+
+#endif  // parallel_algorithm_h_
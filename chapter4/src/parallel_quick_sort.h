@@ -5,6 +5,8 @@
 #include <iostream>
 #include <list>
 
+#include "pool_future.h"
+#include "task_group.h"
 #include "thread_pool.h"
 
 // 1. 函数式编程使用快速排序, 函数式编程类似于数学中的函数
@@ -112,17 +114,86 @@ std::list<T> thread_pool_quick_sort(std::list<T> input) {
   lower_part.splice(lower_part.begin(), input, input.begin(), divide_point);
 
   // 将lower_part部分的排序提交给线程池，Commit返回一个std::future对象
-  auto new_lower = ThreadPool::instance().Commit(&parallel_quick_sort<T>,
-                                                 std::move(lower_part));
+  auto& pool = ThreadPool::instance();
+  auto new_lower =
+      pool.Commit(&thread_pool_quick_sort<T>, std::move(lower_part));
 
   auto new_higher(thread_pool_quick_sort(std::move(input)));
 
   result.splice(result.end(), new_higher);
-  result.splice(result.begin(), new_lower.get());
+  // 不直接调用new_lower.get()阻塞等待, 而是在等待期间帮线程池执行其他任务,
+  // 递归深度超过线程数时, 也不会出现所有线程都阻塞在get()上的情况
+  result.splice(result.begin(), pool.Get(new_lower));
 
   return result;
 }
 
+// 4. 基于pool_future后续操作的快速排序
+// 两半分别排序后, 用when_all + then登记合并操作, 而不是等待lower_part的结果,
+// 任何线程都不会停在中间结果上; then返回的pool_future会自动展开, 递归可以直接返回
+template <typename T>
+pool_future<std::list<T>> continuation_quick_sort(ThreadPool& pool,
+                                                  std::list<T> input) {
+  if (input.size() < 2) {
+    return make_ready_future(pool, std::move(input));
+  }
+  std::list<T> result;
+  result.splice(result.begin(), input, input.begin());
+
+  const T& pivot = *result.begin();
+
+  auto divide_point = std::partition(input.begin(), input.end(),
+                                     [&](T const& t) { return t < pivot; });
+
+  std::list<T> lower_part;
+  lower_part.splice(lower_part.begin(), input, input.begin(), divide_point);
+
+  std::vector<pool_future<std::list<T>>> parts;
+  parts.push_back(
+      pool_async(pool, [&pool, lower = std::move(lower_part)]() mutable {
+        return continuation_quick_sort(pool, std::move(lower));
+      }));
+  parts.push_back(continuation_quick_sort(pool, std::move(input)));
+
+  return when_all(std::move(parts))
+      .then([result = std::move(result)](
+                std::vector<std::list<T>> sorted) mutable {
+        result.splice(result.begin(), sorted[0]);
+        result.splice(result.end(), sorted[1]);
+        return std::move(result);
+      });
+}
+
+// 5. 基于TaskGroup的原地快速排序
+// lower_part交给子任务排序, 当前线程排序剩下的部分后在Wait中汇合,
+// 不需要为每次拆分创建future; Wait期间优先执行自己刚提交的子任务
+template <typename T>
+void task_group_quick_sort(ThreadPool& pool, std::list<T>& data) {
+  if (data.size() < 2) {
+    return;
+  }
+  std::list<T> result;
+  result.splice(result.begin(), data, data.begin());
+
+  const T& pivot = *result.begin();
+
+  auto divide_point = std::partition(data.begin(), data.end(),
+                                     [&](T const& t) { return t < pivot; });
+
+  std::list<T> lower_part;
+  lower_part.splice(lower_part.begin(), data, data.begin(), divide_point);
+
+  TaskGroup group(pool);
+  group.Run(
+      [&pool, &lower_part]() { task_group_quick_sort(pool, lower_part); });
+  task_group_quick_sort(pool, data);
+  group.Wait();
+
+  result.splice(result.begin(), lower_part);
+  result.splice(result.end(), data);
+  data.swap(result);
+}
+
 void test_thread_pool_sort() {
   std::list<int> nums = {6, 1, 0, 7, 5, 2, 9, -1};
   auto sort_result = thread_pool_quick_sort(nums);
@@ -133,4 +204,25 @@ void test_thread_pool_sort() {
   std::cout << std::endl;
 }
 
-#endif
\ No newline at end of file
+void test_continuation_sort() {
+  std::list<int> nums = {6, 1, 0, 7, 5, 2, 9, -1};
+  auto& pool = ThreadPool::instance();
+  auto sort_result = continuation_quick_sort(pool, nums).get();
+  std::cout << "sorted result is ";
+  for (const int num : sort_result) {
+    std::cout << " " << num;
+  }
+  std::cout << std::endl;
+}
+
+void test_task_group_sort() {
+  std::list<int> nums = {6, 1, 0, 7, 5, 2, 9, -1};
+  task_group_quick_sort(ThreadPool::instance(), nums);
+  std::cout << "sorted result is ";
+  for (const int num : nums) {
+    std::cout << " " << num;
+  }
+  std::cout << std::endl;
+}
+
+#endif
@@ -0,0 +1,465 @@
+#ifndef pool_future_h_
+#define pool_future_h_
+#include <atomic>
+#include <condition_variable>
+#include <exception>
+#include <functional>
+#include <future>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <stdexcept>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+#include "function_wrapper.h"
+#include "thread_pool.h"
+
+// 可以挂接后续操作(continuation)的future, 结果就绪时后续操作作为新任务提交给线程池
+// std::future只能get()阻塞等待结果, 多阶段的任务(先并行计算, 再汇总, 再处理)
+// 就要有线程停在中间结果上; pool_future则把"拿到结果之后做什么"登记在共享状态里:
+// 1. then(f): 结果就绪时把f提交给线程池执行, 返回f的结果对应的pool_future;
+//    f本身返回pool_future时会自动展开, 方便写递归的分治算法
+// 2. when_all/when_any: 等待一组pool_future全部/任意一个就绪, 同样不占用线程
+// 3. 前一阶段抛出的异常直接传给后续的future, 不会执行后续操作;
+//    线程池已关闭时后续操作不再执行, 其future收到TaskCancelled异常
+// 和std::future一样, get()/then()会取走结果, 之后这个pool_future就不再有效
+template <typename T>
+class pool_future;
+
+namespace pool_future_detail {
+
+template <typename T>
+struct value_slot {
+  std::optional<T> value;
+
+  template <typename... Args>
+  void set(Args&&... args) {
+    value.emplace(std::forward<Args>(args)...);
+  }
+  T take() { return std::move(*value); }
+};
+
+template <>
+struct value_slot<void> {
+  void set() {}
+  void take() {}
+};
+
+// 共享状态: 结果/异常, 以及结果就绪时要执行的回调
+// 回调在设置结果的线程中直接执行, 只做登记和提交任务这类很轻的工作
+template <typename T>
+class shared_state : public value_slot<T> {
+ public:
+  explicit shared_state(ThreadPool* pool) : pool(pool) {}
+
+  template <typename... Args>
+  void set_value(Args&&... args) {
+    std::unique_lock<std::mutex> lock(mtx);
+    if (ready) {
+      return;
+    }
+    this->set(std::forward<Args>(args)...);
+    Complete(lock);
+  }
+
+  void set_exception(std::exception_ptr e) {
+    std::unique_lock<std::mutex> lock(mtx);
+    if (ready) {
+      return;
+    }
+    error = e;
+    Complete(lock);
+  }
+
+  // 结果已经就绪时直接在当前线程执行回调
+  void on_ready(function_wrapper callback) {
+    {
+      std::lock_guard<std::mutex> lock(mtx);
+      if (!ready) {
+        callbacks.push_back(std::move(callback));
+        return;
+      }
+    }
+    callback();
+  }
+
+  bool is_ready() {
+    std::lock_guard<std::mutex> lock(mtx);
+    return ready;
+  }
+
+  // 在线程池的工作线程中等待时, 帮线程池执行其他任务, 原因同ThreadPool::Get
+  void wait() {
+    if (pool != nullptr && pool->InWorkerThread()) {
+      while (!is_ready()) {
+        pool->RunPendingTask();
+      }
+      return;
+    }
+    std::unique_lock<std::mutex> lock(mtx);
+    cv.wait(lock, [this] { return ready; });
+  }
+
+  ThreadPool* const pool;  // 执行后续操作的线程池, 可以为空, 此时后续操作直接执行
+  std::exception_ptr error;
+
+ private:
+  void Complete(std::unique_lock<std::mutex>& lock) {
+    ready = true;
+    std::vector<function_wrapper> pending;
+    pending.swap(callbacks);
+    lock.unlock();
+    cv.notify_all();
+    for (auto& callback : pending) {
+      callback();
+    }
+  }
+
+  std::mutex mtx;
+  std::condition_variable cv;
+  bool ready = false;
+  std::vector<function_wrapper> callbacks;
+};
+
+template <typename T>
+struct is_pool_future : std::false_type {};
+template <typename T>
+struct is_pool_future<pool_future<T>> : std::true_type {};
+
+// f返回pool_future<U>时, then()的结果是pool_future<U>而不是pool_future<pool_future<U>>
+template <typename R>
+struct unwrap {
+  using type = R;
+};
+template <typename U>
+struct unwrap<pool_future<U>> {
+  using type = U;
+};
+
+// 后续操作f的参数是前一阶段的结果, 结果为void时f没有参数
+template <typename F, typename T>
+struct continuation_result {
+  using type = std::invoke_result_t<F, T>;
+};
+template <typename F>
+struct continuation_result<F, void> {
+  using type = std::invoke_result_t<F>;
+};
+
+// 访问pool_future内部共享状态的入口, 只在本文件内部使用
+struct access {
+  template <typename T>
+  static std::shared_ptr<shared_state<T>> state(pool_future<T>& f) {
+    return std::move(f.state_);
+  }
+  template <typename T>
+  static pool_future<T> make(std::shared_ptr<shared_state<T>> state) {
+    return pool_future<T>(std::move(state));
+  }
+};
+
+// 把src的结果或异常转给dst, 在src就绪的线程中直接执行
+// 回调保存在src里, 只能持有src的裸指针, 否则共享状态会引用自己而无法释放;
+// 回调执行时src一定还存活(正在设置结果的一方持有它)
+template <typename T>
+void forward_to(const std::shared_ptr<shared_state<T>>& src,
+                std::shared_ptr<shared_state<T>> dst) {
+  auto* s = src.get();
+  s->on_ready([s, dst = std::move(dst)]() {
+    if (s->error) {
+      dst->set_exception(s->error);
+    } else if constexpr (std::is_void<T>::value) {
+      dst->set_value();
+    } else {
+      dst->set_value(s->take());
+    }
+  });
+}
+
+// 执行fn(args...)并把结果写入dst
+template <typename R, typename Fn, typename... Args>
+void fulfil(const std::shared_ptr<shared_state<R>>& dst, Fn& fn,
+            Args&&... args) {
+  using Ret = std::invoke_result_t<Fn&, Args...>;
+  try {
+    if constexpr (is_pool_future<Ret>::value) {
+      Ret inner = fn(std::forward<Args>(args)...);
+      forward_to(access::state(inner), dst);
+    } else if constexpr (std::is_void<Ret>::value) {
+      fn(std::forward<Args>(args)...);
+      dst->set_value();
+    } else {
+      dst->set_value(fn(std::forward<Args>(args)...));
+    }
+  } catch (...) {
+    dst->set_exception(std::current_exception());
+  }
+}
+
+// 提交给线程池的后续操作, arg是从前一阶段取出的结果
+// 线程池关闭导致任务被丢弃时, 通过cancel通知后续的future
+template <typename T, typename R, typename Fn>
+struct continuation_task {
+  value_slot<T> arg;
+  std::shared_ptr<shared_state<R>> dst;
+  Fn fn;
+
+  void operator()() {
+    if constexpr (std::is_void<T>::value) {
+      fulfil(dst, fn);
+    } else {
+      fulfil(dst, fn, arg.take());
+    }
+  }
+
+  void cancel(std::exception_ptr e) { dst->set_exception(e); }
+};
+
+template <typename R, typename Fn>
+struct async_task {
+  std::shared_ptr<shared_state<R>> dst;
+  Fn fn;
+
+  void operator()() { fulfil(dst, fn); }
+  void cancel(std::exception_ptr e) { dst->set_exception(e); }
+};
+
+}  // namespace pool_future_detail
+
+template <typename T>
+class pool_future {
+  using state_type = pool_future_detail::shared_state<T>;
+
+ public:
+  pool_future() = default;
+  pool_future(pool_future&&) noexcept = default;
+  pool_future& operator=(pool_future&&) noexcept = default;
+  pool_future(const pool_future&) = delete;
+  pool_future& operator=(const pool_future&) = delete;
+
+  bool valid() const { return state_ != nullptr; }
+  bool is_ready() const { return state_->is_ready(); }
+  void wait() const { state_->wait(); }
+
+  T get() {
+    auto state = std::move(state_);
+    state->wait();
+    if (state->error) {
+      std::rethrow_exception(state->error);
+    }
+    return state->take();
+  }
+
+  // 结果就绪后把f提交给线程池, f的参数是本future的结果(void时没有参数)
+  // 本future出错时不执行f, 异常直接传给返回的future
+  template <typename F>
+  auto then(F&& f, TaskPriority priority = TaskPriority::kNormal) {
+    using Ret =
+        typename pool_future_detail::continuation_result<std::decay_t<F>&,
+                                                         T>::type;
+    using R = typename pool_future_detail::unwrap<Ret>::type;
+    using Task =
+        pool_future_detail::continuation_task<T, R, std::decay_t<F>>;
+
+    auto src = std::move(state_);
+    auto* s = src.get();
+    auto dst = std::make_shared<pool_future_detail::shared_state<R>>(s->pool);
+    s->on_ready([s, task = Task{{}, dst, std::forward<F>(f)},
+                 priority]() mutable {
+      if (s->error) {
+        task.dst->set_exception(s->error);
+        return;
+      }
+      if constexpr (!std::is_void<T>::value) {
+        task.arg.set(s->take());
+      }
+      if (s->pool == nullptr) {
+        task();
+      } else {
+        s->pool->Execute(std::move(task), priority);
+      }
+    });
+    return pool_future_detail::access::make(std::move(dst));
+  }
+
+ private:
+  friend struct pool_future_detail::access;
+
+  explicit pool_future(std::shared_ptr<state_type> state)
+      : state_(std::move(state)) {}
+
+  std::shared_ptr<state_type> state_;
+};
+
+// 用来把其他来源(回调, IO完成通知等)的结果接入pool_future
+// 和std::promise一样, 没有设置结果就析构时, future收到broken_promise异常
+template <typename T>
+class pool_promise {
+ public:
+  // pool为后续操作执行的线程池
+  explicit pool_promise(ThreadPool* pool = nullptr)
+      : state_(std::make_shared<pool_future_detail::shared_state<T>>(pool)) {}
+  pool_promise(pool_promise&&) noexcept = default;
+  pool_promise& operator=(pool_promise&&) noexcept = default;
+  pool_promise(const pool_promise&) = delete;
+  pool_promise& operator=(const pool_promise&) = delete;
+
+  ~pool_promise() {
+    if (state_ != nullptr) {
+      state_->set_exception(std::make_exception_ptr(
+          std::future_error(std::future_errc::broken_promise)));
+    }
+  }
+
+  pool_future<T> get_future() {
+    return pool_future_detail::access::make(state_);
+  }
+
+  template <typename... Args>
+  void set_value(Args&&... args) {
+    state_->set_value(std::forward<Args>(args)...);
+  }
+
+  void set_exception(std::exception_ptr e) { state_->set_exception(e); }
+
+ private:
+  std::shared_ptr<pool_future_detail::shared_state<T>> state_;
+};
+
+// 已经就绪的pool_future, 后续操作提交到pool
+template <typename T>
+pool_future<std::decay_t<T>> make_ready_future(ThreadPool& pool, T&& value) {
+  pool_promise<std::decay_t<T>> promise(&pool);
+  promise.set_value(std::forward<T>(value));
+  return promise.get_future();
+}
+
+inline pool_future<void> make_ready_future(ThreadPool& pool) {
+  pool_promise<void> promise(&pool);
+  promise.set_value();
+  return promise.get_future();
+}
+
+// 和ThreadPool::Commit一样提交任务, 但返回pool_future
+// f返回pool_future时同样会自动展开
+template <typename F, typename... Args>
+auto pool_async(ThreadPool& pool, F&& f, Args&&... args) {
+  auto fn = std::bind(std::forward<F>(f), std::forward<Args>(args)...);
+  using Fn = decltype(fn);
+  using R = typename pool_future_detail::unwrap<std::invoke_result_t<Fn&>>::type;
+  auto dst = std::make_shared<pool_future_detail::shared_state<R>>(&pool);
+  pool.Execute(pool_future_detail::async_task<R, Fn>{dst, std::move(fn)});
+  return pool_future_detail::access::make(std::move(dst));
+}
+
+// 所有输入都就绪后就绪, 结果按输入的顺序排列; 有输入出错时, 得到最先出错的那个异常
+// 计数和结果都在输入就绪的线程中直接更新, 不需要额外的任务
+template <typename T>
+auto when_all(std::vector<pool_future<T>> futures) {
+  using R = std::conditional_t<std::is_void<T>::value, void, std::vector<T>>;
+  struct all_state {
+    std::atomic<size_t> remaining;
+    std::atomic<bool> failed{false};
+    std::exception_ptr error;
+    std::vector<std::optional<
+        std::conditional_t<std::is_void<T>::value, bool, T>>>
+        values;
+    std::shared_ptr<pool_future_detail::shared_state<R>> dst;
+  };
+
+  ThreadPool* pool = nullptr;
+  std::vector<std::shared_ptr<pool_future_detail::shared_state<T>>> states;
+  for (auto& f : futures) {
+    states.push_back(pool_future_detail::access::state(f));
+    if (pool == nullptr) {
+      pool = states.back()->pool;
+    }
+  }
+  auto all = std::make_shared<all_state>();
+  all->remaining.store(states.size());
+  all->values.resize(states.size());
+  all->dst = std::make_shared<pool_future_detail::shared_state<R>>(pool);
+  auto result = pool_future_detail::access::make(all->dst);
+
+  auto finish = [](all_state& a) {
+    if (a.failed.load()) {
+      a.dst->set_exception(a.error);
+    } else if constexpr (std::is_void<T>::value) {
+      a.dst->set_value();
+    } else {
+      std::vector<T> values;
+      values.reserve(a.values.size());
+      for (auto& v : a.values) {
+        values.push_back(std::move(*v));
+      }
+      a.dst->set_value(std::move(values));
+    }
+  };
+  if (states.empty()) {
+    finish(*all);
+    return result;
+  }
+  for (size_t i = 0; i < states.size(); ++i) {
+    auto* s = states[i].get();
+    s->on_ready([all, s, i, finish]() {
+      if (s->error) {
+        if (!all->failed.exchange(true)) {
+          all->error = s->error;
+        }
+      } else if constexpr (std::is_void<T>::value) {
+        all->values[i].emplace(true);
+      } else {
+        all->values[i].emplace(s->take());
+      }
+      // acq_rel保证最后一个完成的线程能看到其他线程写入的结果和异常
+      if (all->remaining.fetch_sub(1, std::memory_order_acq_rel) == 1) {
+        finish(*all);
+      }
+    });
+  }
+  return result;
+}
+
+// 任意一个输入就绪后就绪, 结果是最先就绪的输入的下标和值(void时只有下标)
+// 最先就绪的输入出错时, 得到它的异常; 其余输入的结果被丢弃
+template <typename T>
+auto when_any(std::vector<pool_future<T>> futures) {
+  using R = std::conditional_t<std::is_void<T>::value, size_t,
+                               std::pair<size_t, T>>;
+  if (futures.empty()) {
+    throw std::invalid_argument("when_any requires at least one future");
+  }
+  struct any_state {
+    std::atomic<bool> done{false};
+    std::shared_ptr<pool_future_detail::shared_state<R>> dst;
+  };
+
+  std::vector<std::shared_ptr<pool_future_detail::shared_state<T>>> states;
+  for (auto& f : futures) {
+    states.push_back(pool_future_detail::access::state(f));
+  }
+  auto any = std::make_shared<any_state>();
+  any->dst =
+      std::make_shared<pool_future_detail::shared_state<R>>(states[0]->pool);
+  auto result = pool_future_detail::access::make(any->dst);
+  for (size_t i = 0; i < states.size(); ++i) {
+    auto* s = states[i].get();
+    s->on_ready([any, s, i]() {
+      if (any->done.exchange(true)) {
+        return;
+      }
+      if (s->error) {
+        any->dst->set_exception(s->error);
+      } else if constexpr (std::is_void<T>::value) {
+        any->dst->set_value(i);
+      } else {
+        any->dst->set_value(i, s->take());
+      }
+    });
+  }
+  return result;
+}
+
+#endif  // pool_future_h_
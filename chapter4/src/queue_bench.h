@@ -0,0 +1,128 @@
+#ifndef queue_bench_h_
+#define queue_bench_h_
+#include <chrono>
+#include <cstddef>
+#include <iostream>
+#include <thread>
+#include <vector>
+
+#include "lock_free_queue.h"
+#include "spsc_ring_buffer.h"
+#include "threadsafe_list_queue.h"
+#include "threadsafe_queue.h"
+
+// 线程安全队列的性能测试, 和thread_pool_bench.h一样只用来对比不同实现的相对差距
+
+// producers个线程各push items个元素, consumers个线程用wait_and_pop一共取走所有元素,
+// 返回每秒通过队列的元素数
+template <typename Queue>
+double measure_queue_throughput(int producers, int consumers, int items) {
+  Queue queue;
+  int total = producers * items;
+  std::vector<std::thread> threads;
+  auto start = std::chrono::steady_clock::now();
+  for (int i = 0; i < consumers; ++i) {
+    // 最后一个消费者多取走除不尽的部分
+    int count = total / consumers + (i == consumers - 1 ? total % consumers : 0);
+    threads.emplace_back([&queue, count]() {
+      int value;
+      for (int n = 0; n < count; ++n) {
+        queue.wait_and_pop(value);
+      }
+    });
+  }
+  for (int i = 0; i < producers; ++i) {
+    threads.emplace_back([&queue, items]() {
+      for (int n = 0; n < items; ++n) {
+        queue.push(n);
+      }
+    });
+  }
+  for (auto& t : threads) {
+    t.join();
+  }
+  std::chrono::duration<double> cost = std::chrono::steady_clock::now() - start;
+  return total / cost.count();
+}
+
+// 对比单锁的threadsafe_queue、头尾分离加锁的threadsafe_list_queue和无锁的lock_free_queue:
+// 生产者多于消费者时, 单锁版本中消费者的每次出队都要和所有生产者竞争同一把锁;
+// 线程数超过核数时, 持锁线程被调度出去会让其他线程全部停滞, 无锁版本不受影响
+void bench_threadsafe_queue() {
+  const int kItems = 200000;
+  const int kConfigs[][2] = {{1, 1}, {4, 1}, {4, 4}};
+  for (const auto& config : kConfigs) {
+    int producers = config[0];
+    int consumers = config[1];
+    double single_lock = measure_queue_throughput<threadsafe_queue<int>>(
+        producers, consumers, kItems);
+    double two_lock = measure_queue_throughput<threadsafe_list_queue<int>>(
+        producers, consumers, kItems);
+    double lock_free = measure_queue_throughput<lock_free_queue<int>>(
+        producers, consumers, kItems);
+    std::cout << producers << " producers / " << consumers << " consumers"
+              << std::endl;
+    std::cout << "  threadsafe_queue:      " << single_lock << " items/s"
+              << std::endl;
+    std::cout << "  threadsafe_list_queue: " << two_lock << " items/s"
+              << std::endl;
+    std::cout << "  lock_free_queue:       " << lock_free << " items/s"
+              << std::endl;
+  }
+}
+
+// 一个生产者一个消费者传递items个元素, 返回每秒通过的元素数
+// batch为0时逐个try_push/try_pop, 否则用push_n/pop_n每次最多传递batch个
+inline double measure_spsc_throughput(int items, size_t batch) {
+  spsc_ring_buffer<int> ring(1024);
+  auto start = std::chrono::steady_clock::now();
+  std::thread consumer([&ring, items, batch]() {
+    std::vector<int> buf(std::max<size_t>(batch, 1));
+    int value;
+    for (int n = 0; n < items;) {
+      size_t got = batch == 0 ? (ring.try_pop(value) ? 1 : 0)
+                              : ring.pop_n(buf.begin(), batch);
+      if (got == 0) {
+        std::this_thread::yield();
+      }
+      n += static_cast<int>(got);
+    }
+  });
+  std::vector<int> buf(std::max<size_t>(batch, 1));
+  for (int n = 0; n < items;) {
+    size_t put;
+    if (batch == 0) {
+      put = ring.try_push(n) ? 1 : 0;
+    } else {
+      size_t count = std::min<size_t>(batch, items - n);
+      for (size_t i = 0; i < count; ++i) {
+        buf[i] = n + static_cast<int>(i);
+      }
+      put = ring.push_n(buf.begin(), count);
+    }
+    if (put == 0) {
+      std::this_thread::yield();
+    }
+    n += static_cast<int>(put);
+  }
+  consumer.join();
+  std::chrono::duration<double> cost = std::chrono::steady_clock::now() - start;
+  return items / cost.count();
+}
+
+// 单生产者单消费者: 互斥锁 + 条件变量的threadsafe_queue对比spsc_ring_buffer
+void bench_spsc_queue() {
+  const int kItems = 2000000;
+  double mutex_queue =
+      measure_queue_throughput<threadsafe_queue<int>>(1, 1, kItems);
+  double ring = measure_spsc_throughput(kItems, 0);
+  double ring_batch = measure_spsc_throughput(kItems, 64);
+  std::cout << "threadsafe_queue:            " << mutex_queue << " items/s"
+            << std::endl;
+  std::cout << "spsc_ring_buffer:            " << ring << " items/s"
+            << std::endl;
+  std::cout << "spsc_ring_buffer (batch 64): " << ring_batch << " items/s"
+            << std::endl;
+}
+
+#endif  // queue_bench_h_
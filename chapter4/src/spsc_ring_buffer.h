@@ -0,0 +1,128 @@
+#ifndef spsc_ring_buffer_h_
+#define spsc_ring_buffer_h_
+#include <algorithm>
+#include <atomic>
+#include <cstddef>
+#include <memory>
+#include <stdexcept>
+#include <utility>
+
+// 单生产者单消费者(SPSC)的无等待环形队列
+// 只有一个线程push、一个线程pop时, 互斥锁 + 条件变量的开销(加锁、唤醒)远大于传递数据本身
+// 1. 写位置tail只由生产者修改, 读位置head只由消费者修改, 每个位置只有一个写者,
+//    用普通的load/store(acquire/release)就够了, 两边都没有任何CAS/fetch_add等原子读改写,
+//    每次操作在有限步内完成, 是无等待(wait-free)的
+// 2. head和tail放在不同的缓存行上; 生产者再缓存一份消费者的head(cached_head),
+//    只有按缓存的值判断队列已满时才重新读取head, 消费者同理缓存tail,
+//    大部分操作只访问本方独占的缓存行, 两个核之间几乎没有缓存行来回传递
+// 3. 批量读写(push_n/pop_n)一次发布多个元素, 对方只需看到一次位置的更新
+// 位置是单调递增的计数, 用 位置 & mask 定位槽位, 容量必须是2的幂
+// 和mpmc_bounded_queue一样, 元素类型需要可以默认构造, 读走后槽位中留下被移动过的对象
+template <typename T>
+class spsc_ring_buffer {
+ private:
+  std::unique_ptr<T[]> buffer;
+  size_t mask;
+
+  // 消费者独占的缓存行
+  alignas(64) std::atomic<size_t> head{0};
+  size_t cached_tail = 0;
+  // 生产者独占的缓存行
+  alignas(64) std::atomic<size_t> tail{0};
+  size_t cached_head = 0;
+
+  // 生产者调用, 返回至少需要n个空位时实际可写的空位数
+  size_t writable(size_t tail_pos, size_t n) {
+    size_t capacity = mask + 1;
+    size_t free = capacity - (tail_pos - cached_head);
+    if (free < n) {
+      cached_head = head.load(std::memory_order_acquire);
+      free = capacity - (tail_pos - cached_head);
+    }
+    return free;
+  }
+
+  // 消费者调用, 返回至少需要n个元素时实际可读的元素数
+  size_t readable(size_t head_pos, size_t n) {
+    size_t available = cached_tail - head_pos;
+    if (available < n) {
+      cached_tail = tail.load(std::memory_order_acquire);
+      available = cached_tail - head_pos;
+    }
+    return available;
+  }
+
+ public:
+  explicit spsc_ring_buffer(size_t capacity) {
+    if (capacity < 2 || (capacity & (capacity - 1)) != 0) {
+      throw std::invalid_argument("capacity must be a power of two");
+    }
+    buffer.reset(new T[capacity]);
+    mask = capacity - 1;
+  }
+  spsc_ring_buffer(const spsc_ring_buffer&) = delete;
+  spsc_ring_buffer& operator=(const spsc_ring_buffer&) = delete;
+
+  size_t capacity() const { return mask + 1; }
+
+  // 只能由生产者调用; 左值被拷贝, 右值被移动
+  // 队列满时返回false, 此时即使传入的是右值, value也不会被移走
+  template <typename U>
+  bool try_push(U&& value) {
+    size_t pos = tail.load(std::memory_order_relaxed);
+    if (writable(pos, 1) == 0) {
+      return false;
+    }
+    buffer[pos & mask] = std::forward<U>(value);
+    tail.store(pos + 1, std::memory_order_release);
+    return true;
+  }
+
+  // 只能由消费者调用; 队列空时返回false
+  bool try_pop(T& value) {
+    size_t pos = head.load(std::memory_order_relaxed);
+    if (readable(pos, 1) == 0) {
+      return false;
+    }
+    value = std::move(buffer[pos & mask]);
+    head.store(pos + 1, std::memory_order_release);
+    return true;
+  }
+
+  // 从first开始写入最多n个元素(移动), 返回实际写入的个数
+  template <typename InputIt>
+  size_t push_n(InputIt first, size_t n) {
+    size_t pos = tail.load(std::memory_order_relaxed);
+    n = std::min(n, writable(pos, n));
+    for (size_t i = 0; i < n; ++i, ++first) {
+      buffer[(pos + i) & mask] = std::move(*first);
+    }
+    if (n > 0) {
+      tail.store(pos + n, std::memory_order_release);
+    }
+    return n;
+  }
+
+  // 最多读出max_n个元素写到out, 返回实际读出的个数
+  template <typename OutputIt>
+  size_t pop_n(OutputIt out, size_t max_n) {
+    size_t pos = head.load(std::memory_order_relaxed);
+    size_t n = std::min(max_n, readable(pos, max_n));
+    for (size_t i = 0; i < n; ++i, ++out) {
+      *out = std::move(buffer[(pos + i) & mask]);
+    }
+    if (n > 0) {
+      head.store(pos + n, std::memory_order_release);
+    }
+    return n;
+  }
+
+  // 近似值, 只用于观察; 先读head再读tail, 保证结果不会小于0
+  size_t size() const {
+    size_t head_pos = head.load(std::memory_order_acquire);
+    return tail.load(std::memory_order_acquire) - head_pos;
+  }
+  bool empty() const { return size() == 0; }
+};
+
+#endif  // spsc_ring_buffer_h_
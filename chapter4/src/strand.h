@@ -0,0 +1,135 @@
+#ifndef strand_h_
+#define strand_h_
+#include <deque>
+#include <exception>
+#include <functional>
+#include <future>
+#include <memory>
+#include <mutex>
+#include <utility>
+
+#include "function_wrapper.h"
+#include "thread_pool.h"
+
+// 串行执行器(strand): 提交到同一个Strand的任务按提交顺序逐个执行, 不会并发执行,
+// 但不独占线程, 而是和其他任务共用线程池的工作线程
+// 线程池本身不保证任务的顺序, 以前有序的任务(比如同一个会话的消息)只能各用一个线程处理,
+// 会话多了线程数就不可控; 而一个Strand只是一个任务队列加一个标记:
+// 1. 队列从空变为非空时, 向线程池提交一个"排空"任务, 之后再提交的任务只入队
+// 2. 排空任务逐个执行队列中的任务, 同一时刻最多只有一个排空任务, 所以任务之间互斥;
+//    前后两个任务可能在不同的线程中执行, 通过互斥锁保证前一个任务的写入对后一个可见
+// 3. 一次最多连续执行kMaxBatch个任务, 还有剩余时重新提交自己排到全局队列的队尾,
+//    避免一个繁忙的Strand长期占住工作线程, 其他Strand得不到执行
+// Strand对象析构后, 已经提交的任务仍会执行完
+class Strand {
+ public:
+  static constexpr int kMaxBatch = 64;
+
+  explicit Strand(ThreadPool& pool = ThreadPool::instance(),
+                  TaskPriority priority = TaskPriority::kNormal)
+      : state_(std::make_shared<State>(pool, priority)) {}
+
+  Strand(const Strand&) = delete;
+  Strand& operator=(const Strand&) = delete;
+
+  // 提交不关心结果的任务, 任务抛出的异常会调用std::terminate, 和ThreadPool::Post一样
+  template <class F, class... Args>
+  void Post(F&& f, Args&&... args) {
+    Enqueue(ThreadPool::Task(
+        std::bind(std::forward<F>(f), std::forward<Args>(args)...)));
+  }
+
+  template <class F, class... Args>
+  auto Commit(F&& f, Args&&... args) -> std::future<decltype(f(args...))> {
+    using RetType = decltype(f(args...));
+    auto func = std::bind(std::forward<F>(f), std::forward<Args>(args)...);
+    std::promise<RetType> prom;
+    std::future<RetType> ret = prom.get_future();
+    Enqueue(ThreadPool::Task(ThreadPool::PromiseTask<RetType, decltype(func)>{
+        std::move(func), std::move(prom)}));
+    return ret;
+  }
+
+  // 已经在这个Strand的任务中时直接执行, 否则同Post
+  template <class F, class... Args>
+  void Dispatch(F&& f, Args&&... args) {
+    if (RunningInThisThread()) {
+      std::invoke(std::forward<F>(f), std::forward<Args>(args)...);
+    } else {
+      Post(std::forward<F>(f), std::forward<Args>(args)...);
+    }
+  }
+
+  // 当前线程是否正在执行这个Strand的任务
+  bool RunningInThisThread() const { return current_ == state_.get(); }
+
+ private:
+  struct State {
+    State(ThreadPool& pool, TaskPriority priority)
+        : pool(pool), priority(priority) {}
+
+    ThreadPool& pool;
+    TaskPriority priority;
+    std::mutex mtx;
+    std::deque<ThreadPool::Task> queue;
+    bool scheduled = false;  // 是否已经有排空任务在线程池中
+  };
+
+  // 提交给线程池的排空任务
+  struct Drain {
+    std::shared_ptr<State> state;
+
+    void operator()() {
+      const State* outer = current_;
+      current_ = state.get();
+      for (int i = 0; i < kMaxBatch; ++i) {
+        ThreadPool::Task task;
+        {
+          std::lock_guard<std::mutex> lock(state->mtx);
+          if (state->queue.empty()) {
+            state->scheduled = false;
+            current_ = outer;
+            return;
+          }
+          task = std::move(state->queue.front());
+          state->queue.pop_front();
+        }
+        task();
+      }
+      current_ = outer;
+      // 还有剩余任务, 让出线程, 排到线程池全局队列的后面
+      state->pool.Requeue(ThreadPool::Task(Drain{state}), state->priority);
+    }
+
+    // 线程池关闭时排空任务被丢弃, 队列中的任务也都取消
+    void cancel(std::exception_ptr error) {
+      std::deque<ThreadPool::Task> pending;
+      {
+        std::lock_guard<std::mutex> lock(state->mtx);
+        pending.swap(state->queue);
+        state->scheduled = false;
+      }
+      for (auto& task : pending) {
+        task.cancel(error);
+      }
+    }
+  };
+
+  void Enqueue(ThreadPool::Task task) {
+    {
+      std::lock_guard<std::mutex> lock(state_->mtx);
+      state_->queue.push_back(std::move(task));
+      if (state_->scheduled) {
+        return;
+      }
+      state_->scheduled = true;
+    }
+    state_->pool.Execute(ThreadPool::Task(Drain{state_}), state_->priority);
+  }
+
+  std::shared_ptr<State> state_;
+  // 当前线程正在执行的Strand
+  inline static thread_local const State* current_ = nullptr;
+};
+
+#endif  // strand_h_
@@ -0,0 +1,131 @@
+#ifndef task_group_h_
+#define task_group_h_
+#include <atomic>
+#include <condition_variable>
+#include <exception>
+#include <functional>
+#include <mutex>
+#include <utility>
+
+#include "thread_pool.h"
+
+// 结构化的fork-join: 用Run提交一组子任务, 再用Wait一次等待它们全部完成
+// 和逐个Commit再逐个get()相比:
+// 1. 不需要给每个子任务创建future, 只有一个计数器, 子任务足够小时整个提交过程
+//    没有堆内存分配, 可以用在很细的粒度上
+// 2. Wait期间当前线程帮线程池执行任务, 在工作线程中调用时优先取出自己本地队列中
+//    刚提交的子任务直接执行, 递归分治时不会出现所有线程都在等待的情况
+// 3. 第一个抛出异常的子任务的异常在Wait中重新抛出, 同时整个组被取消,
+//    还没开始执行的子任务不再执行
+// TaskGroup本身不是线程安全的容器: 可以在子任务中继续Run, 但Wait只应由创建它的线程调用
+class TaskGroup {
+ public:
+  explicit TaskGroup(ThreadPool& pool = ThreadPool::instance()) : pool_(pool) {}
+
+  TaskGroup(const TaskGroup&) = delete;
+  TaskGroup& operator=(const TaskGroup&) = delete;
+
+  // 析构前没有Wait时在这里等待, 子任务的异常被忽略
+  ~TaskGroup() {
+    try {
+      Wait();
+    } catch (...) {
+    }
+  }
+
+  template <class F, class... Args>
+  void Run(F&& f, Args&&... args) {
+    pending_.fetch_add(1, std::memory_order_relaxed);
+    auto fn = std::bind(std::forward<F>(f), std::forward<Args>(args)...);
+    pool_.Execute(ThreadPool::Task(Child<decltype(fn)>{this, std::move(fn)}));
+  }
+
+  // 等待所有子任务完成, 有子任务抛出异常时重新抛出第一个异常
+  // 返回后可以继续Run新的子任务, 组的取消状态和异常都被清除
+  void Wait() {
+    while (pending_.load(std::memory_order_acquire) > 0) {
+      if (pool_.RunPendingTask()) {
+        continue;
+      }
+      // 工作线程不能阻塞, 否则所有线程都在等待时子任务没有线程执行;
+      // 其他线程没有可帮忙的任务时挂起, 由最后一个完成的子任务唤醒
+      if (!pool_.InWorkerThread()) {
+        std::unique_lock<std::mutex> lock(mtx_);
+        cv_.wait(lock, [this]() {
+          return pending_.load(std::memory_order_acquire) == 0;
+        });
+      }
+    }
+    std::exception_ptr error;
+    {
+      std::lock_guard<std::mutex> lock(mtx_);
+      error.swap(error_);
+    }
+    cancelled_.store(false);
+    if (error) {
+      std::rethrow_exception(error);
+    }
+  }
+
+  // 取消还没开始执行的子任务, 已经在执行的子任务可以通过IsCancelled检查后提前返回
+  void Cancel() { cancelled_.store(true); }
+  bool IsCancelled() const { return cancelled_.load(); }
+
+ private:
+  template <typename Fn>
+  struct Child {
+    TaskGroup* group;
+    Fn fn;
+
+    void operator()() {
+      if (!group->cancelled_.load()) {
+        try {
+          fn();
+        } catch (...) {
+          group->Fail(std::current_exception());
+        }
+      }
+      group->Finish();
+    }
+
+    // 线程池关闭时没有执行就被丢弃, 按失败处理, 否则Wait会一直等下去
+    void cancel(std::exception_ptr error) {
+      group->Fail(error);
+      group->Finish();
+    }
+  };
+
+  void Fail(std::exception_ptr error) {
+    std::lock_guard<std::mutex> lock(mtx_);
+    if (!error_) {
+      error_ = error;
+    }
+    cancelled_.store(true);
+  }
+
+  // 不是最后一个子任务时只减计数, 不加锁
+  // 最后一个子任务持有锁减到0并通知: 既不会在Wait检查完计数、还没挂起时错过通知,
+  // 也保证Wait返回(它在返回前要加锁取异常)、TaskGroup析构时这里已经不再访问它
+  void Finish() {
+    size_t pending = pending_.load(std::memory_order_relaxed);
+    while (pending > 1) {
+      if (pending_.compare_exchange_weak(pending, pending - 1,
+                                         std::memory_order_acq_rel)) {
+        return;
+      }
+    }
+    std::lock_guard<std::mutex> lock(mtx_);
+    if (pending_.fetch_sub(1, std::memory_order_acq_rel) == 1) {
+      cv_.notify_all();
+    }
+  }
+
+  ThreadPool& pool_;
+  std::atomic<size_t> pending_{0};
+  std::atomic<bool> cancelled_{false};
+  std::mutex mtx_;
+  std::condition_variable cv_;
+  std::exception_ptr error_;
+};
+
+#endif  // task_group_h_
@@ -1,14 +1,36 @@
 #ifndef thread_pool_h_
 #define thread_pool_h_
 
+#include <algorithm>
 #include <atomic>
+#include <chrono>
 #include <condition_variable>
 #include <future>
-#include <iostream>
 #include <queue>
+#include <stdexcept>
+#include <string>
+#include <system_error>
 #include <thread>
+#include <type_traits>
 #include <vector>
 #include <functional>
+#include <memory>
+
+#include "cancellation_token.h"
+#include "function_wrapper.h"
+#include "latency_histogram.h"
+#include "mpmc_bounded_queue.h"
+#include "thread_pool_metrics.h"
+#include "timer_wheel.h"
+#include "work_stealing_queue.h"
+
+#ifdef __linux__
+#include <pthread.h>
+#include <sched.h>
+#endif
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#endif
 // 一个线程池大致需要实现三件事:
 // 1. task任务队列
 // 2. 封装task, 其回调函数需要是一个模板
@@ -18,84 +40,1405 @@
 // 1. 线程池要执行的任务是无序的, 如果是要求有序的任务则不应该用线程池来做
 // 2. 如果执行的任务关联性很强或者是互斥操作, 也不应该用线程池来做
 
+// 任务调度方式:
+// kSharedQueue: 所有任务都放入同一个全局队列, 所有线程争抢同一把锁
+// kWorkStealing: 在全局队列之外, 每个工作线程还有一个自己的本地队列,
+//   在工作线程内部提交的任务(比如递归分治时拆分出来的子任务)放入本地队列,
+//   空闲线程依次从 本地队列 -> 全局队列 -> 其他线程的本地队列 中取任务
+enum class SchedulePolicy { kSharedQueue, kWorkStealing };
+
+// 任务优先级, 全局队列按优先级分成几条通道(lane), 工作线程总是先取高优先级通道的任务
+// kHigh: 对延迟敏感的任务
+// kNormal: 默认优先级, 工作线程内部提交的子任务也是这个优先级
+// kBackground: 批处理之类的后台任务
+enum class TaskPriority { kHigh = 0, kNormal = 1, kBackground = 2 };
+constexpr int kPriorityLevels = 3;
+static_assert(kPriorityLevels == WorkerMetrics::kLaneNum,
+              "WorkerMetrics keeps one wait-time histogram per priority lane");
+
+// 关闭线程池的方式
+// kDrain: 不再接受外部提交的新任务, 等已接受的任务(包括它们执行时提交的子任务)全部执行完
+// kAbort: 正在执行的任务执行完后就退出, 队列中剩余的任务被取消
+enum class ShutdownMode { kDrain, kAbort };
+
+// 任务没有执行就被取消时, 与之关联的future中保存的异常
+class TaskCancelled : public std::runtime_error {
+ public:
+  explicit TaskCancelled(const std::string& what) : std::runtime_error(what) {}
+};
+
+// 任务开始执行前就已经超过了截止时间
+class TaskDeadlineExceeded : public TaskCancelled {
+ public:
+  explicit TaskDeadlineExceeded(const std::string& what)
+      : TaskCancelled(what) {}
+};
+
+// 线程池过载时拒绝接受的任务, 与之关联的future中保存的异常
+class TaskRejected : public TaskCancelled {
+ public:
+  explicit TaskRejected(const std::string& what) : TaskCancelled(what) {}
+};
+
+// 线程池过载时对外部新提交任务的处理方式, 见ThreadPoolOptions::overload_policy
+// kNone: 不做准入控制, 任务总是进入队列
+// kReject: 直接拒绝, Commit返回的future中保存TaskRejected异常, Post/Execute返回false
+// kCallerRuns: 在提交任务的线程中直接执行, 提交方被拖慢, 自然降低了提交速度
+enum class OverloadPolicy { kNone, kReject, kCallerRuns };
+
+// 任务的类型
+// kCompute: 计算型任务, 在线程池自己的工作线程中执行
+// kBlocking: 会长时间阻塞在IO、sleep、锁上的任务(比如查询数据库), 交给伴随的阻塞线程池执行
+//   阻塞线程池按需创建, 是弹性的, 线程数上限比较大; 阻塞型任务在等待时不会占住计算线程,
+//   混合负载下计算线程始终在做计算, 而不是陪着IO一起等待
+enum class TaskKind { kCompute, kBlocking };
+
+// 提交单个任务时的选项
+// token被取消或者超过deadline时, 还在队列中的任务不再执行, future中保存
+// TaskCancelled/TaskDeadlineExceeded异常; 已经开始执行的任务不会被打断,
+// 可以通过ThreadPool::CancellationRequested()检查后自行提前返回
+// 比如客户端请求超时后, 为它排队的任务都已经没有意义, 过载时直接丢弃能腾出大量算力
+struct TaskOptions {
+  TaskPriority priority = TaskPriority::kNormal;
+  TaskKind kind = TaskKind::kCompute;
+  CancellationToken token;
+  std::chrono::steady_clock::time_point deadline =
+      std::chrono::steady_clock::time_point::max();
+};
+
+// 空闲线程等待任务的方式
+// kBlock: 没有任务时直接挂起在条件变量上, 新任务到来时要经过一次futex唤醒和上下文切换
+// kSpinThenPark: 先自旋spin_count次(每次执行一条pause指令), 再让出时间片yield_count次,
+//   期间一直没有任务才挂起; 短暂空闲后到来的任务可以立刻被执行, 代价是空转消耗CPU
+enum class WaitStrategy { kBlock, kSpinThenPark };
+
+// 自旋等待时执行的pause指令, 降低自旋时的功耗, 并让出流水线资源给同一物理核上的超线程
+inline void CpuRelax() {
+#if defined(__x86_64__) || defined(__i386__)
+  _mm_pause();
+#elif defined(__aarch64__)
+  asm volatile("yield");
+#endif
+}
+
+// 线程池的配置项
+struct ThreadPoolOptions {
+  // 工作线程数, 0表示使用std::thread::hardware_concurrency()
+  unsigned int thread_num = 0;
+  SchedulePolicy policy = SchedulePolicy::kWorkStealing;
+  // 工作线程允许运行的CPU编号集合, 为空表示不绑核
+  // 比如把延迟敏感的线程池和批处理的线程池绑到不同的核上, 互不干扰
+  std::vector<int> cpu_affinity;
+  // 线程名前缀, 线程名为"前缀-序号", 方便在top/gdb/perf里区分不同的线程池;
+  // Linux下线程名最长15个字符, 超出的部分会被截断
+  std::string name_prefix = "pool";
+  std::chrono::nanoseconds aging_threshold = std::chrono::milliseconds(100);
+
+  // 弹性模式: 线程数在[thread_num, max_thread_num]之间随负载伸缩
+  // 全局队列中的任务数比空闲线程数多出grow_queue_depth个, 并且持续了grow_delay,
+  // 就新建一个线程, 积压仍在时每隔grow_delay再加一个; 短暂的突发不会把线程数撑到上限
+  // 超出thread_num的线程空闲超过keep_alive后退出
+  bool elastic = false;
+  unsigned int max_thread_num = 0;  // 0表示thread_num的4倍
+  size_t grow_queue_depth = 1;
+  std::chrono::nanoseconds grow_delay = std::chrono::milliseconds(10);
+  std::chrono::milliseconds keep_alive = std::chrono::seconds(60);
+
+  // 全局队列使用有界的无锁环形队列(每个优先级通道一个), 代替std::mutex + std::queue;
+  // 提交任务时只在有线程挂起时才加锁唤醒, 队列满时提交方会等待(背压)
+  // queue_capacity是每个通道的容量, 必须是2的幂
+  bool lock_free_queue = false;
+  size_t queue_capacity = 4096;
+
+  WaitStrategy wait_strategy = WaitStrategy::kBlock;
+  int spin_count = 2000;
+  int yield_count = 16;
+
+  // 定时任务(ScheduleAfter/ScheduleAt/ScheduleEvery)的时间精度, 到期时间向上取整到tick
+  std::chrono::nanoseconds timer_tick = std::chrono::milliseconds(1);
+
+  // 阻塞线程池(执行TaskKind::kBlocking的任务)的常驻线程数和最大线程数,
+  // 空闲线程同样在keep_alive后退出, 线程名前缀为"name_prefix-io"
+  unsigned int blocking_thread_num = 1;
+  unsigned int max_blocking_thread_num = 64;
+
+  // 准入控制: 队列无限增长时, 排队时间和内存占用都会跟着无限增长, 过载时宁可尽早拒绝
+  // 满足任一条件即认为过载:
+  // 1. max_queue_depth不为0, 且队列中的任务数达到max_queue_depth
+  // 2. target_queue_delay不为0, 且任务的排队时间在codel_interval内一直高于target_queue_delay
+  //    (参考CoDel: 只看持续的排队时间, 短暂的突发不算过载; 排队时间回落到目标以下就恢复)
+  // 只对非工作线程提交的任务生效, 工作线程提交的子任务总是被接受,
+  // 否则TaskGroup等fork-join中的子任务会被拒绝
+  OverloadPolicy overload_policy = OverloadPolicy::kNone;
+  size_t max_queue_depth = 0;
+  std::chrono::nanoseconds target_queue_delay{0};
+  std::chrono::nanoseconds codel_interval = std::chrono::milliseconds(100);
+};
+
 class ThreadPool {
  public:
+  // 可以按需创建多个相互独立的线程池, 比如延迟敏感的任务和批处理任务各用一个
+  explicit ThreadPool(const ThreadPoolOptions& options = ThreadPoolOptions())
+      : stop_(false), options_(options) {
+    if (options_.thread_num == 0) {
+      options_.thread_num = std::thread::hardware_concurrency();
+    }
+    options_.thread_num = std::max(options_.thread_num, 1u);
+    if (options_.max_thread_num == 0) {
+      options_.max_thread_num = options_.thread_num * 4;
+    }
+    options_.max_thread_num =
+        std::max(options_.max_thread_num, options_.thread_num);
+    aging_threshold_ns_ = options_.aging_threshold.count();
+    Start();
+  }
+
+  explicit ThreadPool(unsigned int thread_num)
+      : ThreadPool(MakeOptions(thread_num)) {}
+
   ThreadPool(const ThreadPool&) = delete;
   ThreadPool& operator=(const ThreadPool&) = delete;
-  ~ThreadPool() { Stop(); }
+  // 析构时按kAbort关闭, 需要执行完所有已接受的任务时先调用Shutdown(ShutdownMode::kDrain)
+  ~ThreadPool() { Shutdown(ShutdownMode::kAbort); }
 
+  // 全局共享的默认线程池, 线程数等于硬件并发数
   static ThreadPool& instance() {
     static ThreadPool instance;
     return instance;
   }
 
-  using Task = std::packaged_task<void()>;
+  // 当前存活的工作线程数, 弹性模式下会随负载变化
+  size_t ThreadCount() const { return live_num_.load(); }
+
+  // 当前线程是否是本线程池的工作线程
+  bool InWorkerThread() const { return local_owner_ == this; }
+
+  // 队列中的任务是只能移动的function_wrapper, 小的可调用对象直接存放在任务内部
+  using Task = function_wrapper;
+  using Clock = std::chrono::steady_clock;
 
   // 可变参数模板，返回一个std::future<T>的对象，T是函数f的返回值类型
   template <class F, class... Args>
   auto Commit(F&& f, Args&&... args) -> std::future<decltype(f(args...))> {
+    return Commit(TaskPriority::kNormal, std::forward<F>(f),
+                  std::forward<Args>(args)...);
+  }
+
+  // 指定优先级提交任务
+  template <class F, class... Args>
+  auto Commit(TaskPriority priority, F&& f, Args&&... args)
+      -> std::future<decltype(f(args...))> {
     using RetType = decltype(f(args...));
-    if (stop_.load()) {
-      return std::future<RetType>{};
+    if (Rejecting()) {
+      return CancelledFuture<RetType>();
     }
-    auto task = std::make_shared<std::packaged_task<RetType()>>(
-        std::bind(std::forward<F>(f), std::forward<Args>(args)...));
     // std::bind将函数f和它的参数绑定在一起, 得到一个无参数的函数
+    auto func = std::bind(std::forward<F>(f), std::forward<Args>(args)...);
+    std::promise<RetType> prom;
+    std::future<RetType> ret = prom.get_future();
+    // 把绑定后的函数和promise一起移动进任务里, 任务执行时把返回值或异常写入promise
+    // 以前的写法是make_shared一个std::packaged_task<RetType()>, 再用捕获了它的
+    // lambda构造std::packaged_task<void()>, 每个任务至少要三次堆内存分配;
+    // 现在任务本身只能移动, 不需要shared_ptr来延长生命周期, 只剩promise的共享状态
+    Push(Task(PromiseTask<RetType, decltype(func)>{std::move(func),
+                                                    std::move(prom)}),
+         priority);
+    return ret;
+  }
 
-    std::future<RetType> ret = task->get_future();
-    {
-      std::lock_guard<std::mutex> lock(mtx_);
-      tasks_.emplace([task] { (*task)(); });
-      // 用lambda表达式构造一个std::packaged_task<void()>对象, 插入任务队列中
-      // 等从任务队列中取出Task, 执行Task();
-      // 实际上就是执行std::bind绑定得到的那个无参函数
-      // lambda表达式捕获了局部变量task的值, 使task的引用计数+1,
-      // 保证task在任务函数执行前都是安全的, 不会被释放掉, 从而达到伪闭包的效果
-    }
-    cv_.notify_one();
+  // 指定取消token和截止时间提交任务, 提交时已经取消或超时的任务直接返回保存了异常的future
+  template <class F, class... Args>
+  auto Commit(const TaskOptions& task_options, F&& f, Args&&... args)
+      -> std::future<decltype(f(args...))> {
+    using RetType = decltype(f(args...));
+    if (Rejecting()) {
+      return CancelledFuture<RetType>();
+    }
+    if (auto error = CheckCancelled(task_options.token, task_options.deadline)) {
+      std::promise<RetType> prom;
+      prom.set_exception(error);
+      return prom.get_future();
+    }
+    auto func = std::bind(std::forward<F>(f), std::forward<Args>(args)...);
+    std::promise<RetType> prom;
+    std::future<RetType> ret = prom.get_future();
+    Push(Task(PromiseTask<RetType, decltype(func)>{std::move(func),
+                                                    std::move(prom)}),
+         task_options);
     return ret;
   }
 
+  // 提交一个不关心结果的任务, 不创建future, 绑定后的函数足够小时整个提交过程
+  // 没有堆内存分配; 任务抛出的异常没有地方传递, 会像std::thread一样调用std::terminate
+  // 返回任务是否被接受(包括过载时在当前线程中执行)
+  template <class F, class... Args>
+  auto Post(F&& f, Args&&... args) -> decltype(void(f(args...)), bool()) {
+    return Post(TaskPriority::kNormal, std::forward<F>(f),
+                std::forward<Args>(args)...);
+  }
+
+  // 线程池关闭或过载拒绝时任务被直接丢弃
+  template <class F, class... Args>
+  bool Post(TaskPriority priority, F&& f, Args&&... args) {
+    if (Rejecting()) {
+      return false;
+    }
+    return Push(
+        Task(std::bind(std::forward<F>(f), std::forward<Args>(args)...)),
+        priority);
+  }
+
+  // 被取消或超时的任务被直接丢弃
+  template <class F, class... Args>
+  bool Post(const TaskOptions& task_options, F&& f, Args&&... args) {
+    if (Rejecting() ||
+        CheckCancelled(task_options.token, task_options.deadline)) {
+      return false;
+    }
+    return Push(
+        Task(std::bind(std::forward<F>(f), std::forward<Args>(args)...)),
+        task_options);
+  }
+
+  // 提交阻塞型任务, 等价于kind为TaskKind::kBlocking的Commit
+  template <class F, class... Args>
+  auto CommitBlocking(F&& f, Args&&... args)
+      -> std::future<decltype(f(args...))> {
+    TaskOptions task_options;
+    task_options.kind = TaskKind::kBlocking;
+    return Commit(task_options, std::forward<F>(f),
+                  std::forward<Args>(args)...);
+  }
+
+  // 提交一个已经封装好的任务, 供在线程池之上实现的组件(future的回调等)使用
+  // 线程池关闭或过载拒绝时任务不会执行, 而是调用task.cancel()并传入对应的异常;
+  // 返回任务是否被接受
+  bool Execute(Task task, TaskPriority priority = TaskPriority::kNormal) {
+    return Execute(std::move(task), MakeTaskOptions(priority));
+  }
+
+  bool Execute(Task task, const TaskOptions& task_options) {
+    if (Rejecting()) {
+      task.cancel(std::make_exception_ptr(
+          TaskCancelled("thread pool is shut down")));
+      return false;
+    }
+    if (auto error = CheckCancelled(task_options.token, task_options.deadline)) {
+      task.cancel(error);
+      return false;
+    }
+    return Push(std::move(task), task_options);
+  }
+
+  // 把任务放到全局队列对应通道的队尾, 在工作线程中调用也不会放入本地队列
+  // 供主动让出线程的任务(比如Strand的排空任务)重新提交自己: 本地队列是后进先出的,
+  // 放进去会被当前线程立刻取回执行, 起不到让出的作用
+  bool Requeue(Task task, TaskPriority priority = TaskPriority::kNormal) {
+    if (Rejecting()) {
+      task.cancel(std::make_exception_ptr(
+          TaskCancelled("thread pool is shut down")));
+      return false;
+    }
+    CurrentMetrics().tasks_submitted.fetch_add(1, std::memory_order_relaxed);
+    QueuedTask item(std::move(task), priority, Clock::now());
+    Wake(1, PushGlobal(&item, 1, static_cast<int>(priority)));
+    return true;
+  }
+
+  // 批量提交[first, last)中的无参可调用对象, 返回与之一一对应的future
+  // 所有任务在一次加锁中放入队列, 再按需唤醒min(任务数, 挂起线程数)个线程,
+  // 避免逐个Commit时每个任务都加一次锁、notify一次
+  // 区间中的元素会被拷贝, 如需移动可以传入std::make_move_iterator
+  template <class InputIt>
+  auto CommitBatch(InputIt first, InputIt last,
+                   TaskPriority priority = TaskPriority::kNormal)
+      -> std::vector<std::future<decltype((*first)())>> {
+    using RetType = decltype((*first)());
+    using Fn = std::decay_t<decltype(*first)>;
+    std::vector<std::future<RetType>> rets;
+    if (Rejecting()) {
+      for (; first != last; ++first) {
+        rets.push_back(CancelledFuture<RetType>());
+      }
+      return rets;
+    }
+    std::vector<Task> tasks;
+    for (; first != last; ++first) {
+      std::promise<RetType> prom;
+      rets.push_back(prom.get_future());
+      tasks.emplace_back(PromiseTask<RetType, Fn>{*first, std::move(prom)});
+    }
+    PushBatch(tasks, priority);
+    return rets;
+  }
+
+  // 批量提交不关心结果的任务, 返回任务是否被接受
+  template <class InputIt>
+  bool PostBatch(InputIt first, InputIt last,
+                 TaskPriority priority = TaskPriority::kNormal) {
+    if (Rejecting()) {
+      return false;
+    }
+    std::vector<Task> tasks;
+    for (; first != last; ++first) {
+      tasks.emplace_back(*first);
+    }
+    return PushBatch(tasks, priority);
+  }
+
+  // 关闭线程池, 不能在线程池自己的工作线程中调用
+  // 关闭后外部提交的任务不会再被接受: Commit返回的future中保存TaskCancelled异常,
+  // Post的任务被直接丢弃; kDrain模式下正在执行的任务提交的子任务仍然会被接受
+  // 被取消的任务如果有future, future中保存TaskCancelled异常; 整个过程不输出任何内容
+  void Shutdown(ShutdownMode mode = ShutdownMode::kDrain) {
+    Shutdown(mode == ShutdownMode::kDrain ? Clock::time_point::max()
+                                          : Clock::time_point::min());
+  }
+
+  // 排空队列直到deadline, 超时后剩余的任务被取消; 返回是否在deadline前全部执行完
+  // 还没到期的定时任务不会再执行, 直接被取消
+  // 阻塞线程池和本线程池一起排空, 两边的任务互相提交的子任务都会被接受
+  bool Shutdown(Clock::time_point deadline) {
+    StopTimer();
+    bool drained = false;
+    {
+      std::unique_lock<std::mutex> lock(mtx_);
+      shutdown_.store(true);
+      // 工作线程挂起前会通知drain_cv_, 这里再每1ms检查一次作为兜底
+      // 阻塞型任务可能在本线程池排空之后才提交子任务回来, 所以最后再检查一次本线程池
+      while (!(drained = Drained() && BlockingDrained() && Drained()) &&
+             Clock::now() < deadline) {
+        drain_cv_.wait_until(
+            lock, std::min(deadline, Clock::now() + std::chrono::milliseconds(1)));
+      }
+    }
+    StopBlocking();
+    Stop();
+    CancelPending();
+    return drained;
+  }
+
+  template <class Rep, class Period>
+  bool ShutdownFor(std::chrono::duration<Rep, Period> timeout) {
+    return Shutdown(Clock::now() + timeout);
+  }
+
+  // 取出一个待执行的任务在当前线程执行, 没有任务时让出时间片;
+  // 返回是否执行了任务
+  bool RunPendingTask() {
+    QueuedTask task;
+    if (TryPop(task)) {
+      RunTask(task);
+      return true;
+    }
+    std::this_thread::yield();
+    return false;
+  }
+
+  // 等待future就绪期间, 当前线程不是阻塞挂起, 而是帮线程池执行其他待处理的任务
+  // 在线程池的任务中等待另一个任务的结果时(比如递归分治), 应该用Get/Wait代替
+  // future.get(), 否则所有工作线程都可能阻塞在get()上, 而它们等待的任务还在队列里
+  // 没有线程去执行, 线程池就"饿死"了
+  // 注意: 等待期间执行的任务可能与当前任务无关, 所以任务里不应再持有锁去等待
+  template <typename T>
+  void Wait(const std::future<T>& fut) {
+    while (fut.wait_for(std::chrono::seconds(0)) !=
+           std::future_status::ready) {
+      if (RunPendingTask()) {
+        continue;
+      }
+      // 非工作线程没有可帮忙的任务时直接挂起等待, 不再空转
+      if (!InWorkerThread()) {
+        fut.wait();
+      }
+    }
+  }
+
+  template <typename T>
+  T Get(std::future<T>& fut) {
+    Wait(fut);
+    return fut.get();
+  }
+
+  // 定时任务: 到期后把任务提交给线程池执行, 不需要占用一个工作线程sleep等待
+  // 所有定时器由一个定时器线程管理(第一次使用时才创建), 底层是分层时间轮,
+  // 添加和取消都是O(1), 可以同时存在几十万个等待中的定时器
+  // 返回的TimerId用于CancelTimer; 线程池关闭后返回无效的TimerId, 任务被丢弃
+  // 没有参数时可调用对象直接存入任务, 任务被丢弃时会调用它的cancel(如果有)
+  using TimerId = TimerWheel::TimerId;
+
+  template <class F, class... Args>
+  TimerId ScheduleAt(Clock::time_point when, F&& f, Args&&... args) {
+    return AddTimer(
+        when, MakeTask(std::forward<F>(f), std::forward<Args>(args)...),
+        std::chrono::nanoseconds(0));
+  }
+
+  template <class Rep, class Period, class F, class... Args>
+  TimerId ScheduleAfter(std::chrono::duration<Rep, Period> delay, F&& f,
+                        Args&&... args) {
+    return ScheduleAt(Clock::now() + delay, std::forward<F>(f),
+                      std::forward<Args>(args)...);
+  }
+
+  // 从现在起每隔period执行一次, 直到CancelTimer或线程池关闭
+  // 上一次还没执行完时下一次可能已经开始, f需要能在多个线程中同时执行;
+  // 定时器线程被耽误而错过的周期只执行一次, 不会集中补发; 但已经到期的任务照常提交,
+  // 线程池繁忙时它们会在队列中排队
+  template <class Rep, class Period, class F, class... Args>
+  TimerId ScheduleEvery(std::chrono::duration<Rep, Period> period, F&& f,
+                        Args&&... args) {
+    return AddTimer(
+        Clock::now() + period,
+        MakeTask(std::forward<F>(f), std::forward<Args>(args)...),
+        std::chrono::duration_cast<std::chrono::nanoseconds>(period));
+  }
+
+  // 取消还没到期的定时任务; 已经到期提交给线程池、或者已经取消过的返回false
+  bool CancelTimer(TimerId id) {
+    std::lock_guard<std::mutex> lock(timer_mtx_);
+    return timer_ != nullptr && timer_->Cancel(id);
+  }
+
+  // 在任务中调用, 检查当前正在执行的任务是否已被取消或超过截止时间
+  // 耗时较长的任务应该定期检查, 发现已取消时尽早返回; 不在任务中调用时返回false
+  static bool CancellationRequested() {
+    const QueuedTask* task = current_task_;
+    return task != nullptr &&
+           (task->token.IsCancelled() ||
+            (task->deadline != Clock::time_point::max() &&
+             Clock::now() >= task->deadline));
+  }
+
+  // 老化阈值: 低一级通道的任务排队超过这个时间后, 会先于之后才入队的高一级通道的任务执行,
+  // 避免高优先级任务持续涌入时后台任务被饿死
+  void SetAgingThreshold(std::chrono::nanoseconds threshold) {
+    aging_threshold_ns_.store(threshold.count());
+  }
+
+  // 各优先级通道的任务从入队到开始执行的等待时间分布, 可以查看p99等分位数
+  // 工作线程内部提交、进入本地队列的任务计入kNormal
+  LatencyHistogram WaitTime(TaskPriority priority) const {
+    return Metrics().lane_wait_time[static_cast<int>(priority)];
+  }
+
+  // 合并所有线程的统计数据, 得到一个快照
+  ThreadPoolMetrics Metrics() const {
+    ThreadPoolMetrics metrics;
+    metrics.name = options_.name_prefix;
+    for (const auto& worker : workers_) {
+      metrics.Merge(worker->metrics, worker->running.load(), false);
+    }
+    metrics.Merge(external_metrics_, false, true);
+    for (int i = 0; i < kPriorityLevels; ++i) {
+      metrics.lane_depth[i] = std::max(lane_pending_[i].load(), 0);
+      metrics.queue_depth += metrics.lane_depth[i];
+    }
+    metrics.queue_depth += std::max(local_pending_.load(), 0);
+    metrics.live_threads = live_num_.load();
+    metrics.idle_threads = thread_num_.load();
+    metrics.overloaded = Overloaded();
+    return metrics;
+  }
+
+  // 当前是否处于过载状态, 过载时外部提交的任务按overload_policy处理
+  bool Overloaded() const { return OverloadedFor(0); }
+
+  // 文本格式的统计数据, 可以直接暴露给监控系统采集
+  std::string DumpMetrics() const { return Metrics().ToString(); }
+
+  // 把函数的返回值或异常写入promise, 相当于不需要堆内存的std::packaged_task
+  // 任务被取消时future中保存取消的异常; 也供在线程池之上实现的组件(Strand等)使用
+  template <typename R, typename Fn>
+  struct PromiseTask {
+    Fn fn;
+    std::promise<R> prom;
+    void operator()() {
+      try {
+        if constexpr (std::is_void<R>::value) {
+          fn();
+          prom.set_value();
+        } else {
+          prom.set_value(fn());
+        }
+      } catch (...) {
+        prom.set_exception(std::current_exception());
+      }
+    }
+    void cancel(std::exception_ptr error) { prom.set_exception(error); }
+  };
+
  private:
-  ThreadPool(unsigned int thread_num = 5) : stop_(false) {
-    thread_num_ = thread_num < 1 ? 1 : thread_num;
-    Start();
+
+  template <typename R>
+  static std::future<R> CancelledFuture() {
+    std::promise<R> prom;
+    prom.set_exception(std::make_exception_ptr(
+        TaskCancelled("thread pool is shut down")));
+    return prom.get_future();
+  }
+
+  // 是否拒绝新提交的任务: 已经停止, 或者正在关闭且不是在工作线程中提交的
+  bool Rejecting() const {
+    return stop_.load() ||
+           (shutdown_.load() && !InWorkerThread() && !InBlockingThread());
+  }
+
+  bool InBlockingThread() const {
+    return local_owner_ != nullptr && local_owner_ == blocking_.load();
+  }
+
+  bool BlockingDrained() const {
+    ThreadPool* blocking = blocking_.load();
+    return blocking == nullptr || blocking->Drained();
+  }
+
+  // 已提交的任务是否都执行完或被取消了
+  // 先读完成数再读提交数: 任务执行中提交的子任务, 提交一定发生在这个任务完成之前,
+  // 看到了任务完成(acquire)就一定能看到子任务的提交, 不会在子任务还在排队时误判为已排空
+  bool Drained() const {
+    uint64_t finished = 0;
+    uint64_t submitted = 0;
+    auto count_finished = [&finished](const WorkerMetrics& m) {
+      finished += m.tasks_completed.load(std::memory_order_acquire) +
+                  m.tasks_cancelled.load(std::memory_order_acquire);
+    };
+    for (const auto& worker : workers_) {
+      count_finished(worker->metrics);
+    }
+    count_finished(external_metrics_);
+    for (const auto& worker : workers_) {
+      submitted += worker->metrics.tasks_submitted.load();
+    }
+    submitted += external_metrics_.tasks_submitted.load();
+    return finished >= submitted;
+  }
+
+  // 取消队列中剩余的任务, 在所有工作线程退出后调用
+  // 先把任务都取出来, 释放锁之后再取消, 因为取消时可能会触发回调
+  void CancelPending() {
+    std::vector<QueuedTask> pending;
+    QueuedTask task;
+    // 与PushGlobal中入队后的栅栏配对: 要么这里能取到环形队列中新放入的任务,
+    // 要么提交者看到stop_并自己取消它
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    {
+      std::lock_guard<std::mutex> lock(mtx_);
+      for (int i = 0; i < kPriorityLevels; ++i) {
+        while (!lanes_[i].empty()) {
+          pending.push_back(std::move(lanes_[i].front()));
+          lanes_[i].pop();
+        }
+        while (rings_[i] && rings_[i]->try_pop(task)) {
+          pending.push_back(std::move(task));
+        }
+        lane_pending_[i] = 0;
+      }
+    }
+    for (auto& worker : workers_) {
+      while (worker->queue.try_pop(task)) {
+        pending.push_back(std::move(task));
+      }
+    }
+    local_pending_ = 0;
+    CancelTasks(pending.data(), pending.size());
+  }
+
+  // 队列中的元素, 除了任务本身还记录了优先级、入队时间, 以及取消token和截止时间
+  struct QueuedTask {
+    QueuedTask() = default;
+    QueuedTask(Task task, TaskPriority priority, Clock::time_point enqueue_time,
+               CancellationToken token = CancellationToken(),
+               Clock::time_point deadline = Clock::time_point::max())
+        : task(std::move(task)),
+          priority(priority),
+          enqueue_time(enqueue_time),
+          token(std::move(token)),
+          deadline(deadline) {}
+
+    Task task;
+    TaskPriority priority = TaskPriority::kNormal;
+    Clock::time_point enqueue_time;
+    CancellationToken token;
+    Clock::time_point deadline = Clock::time_point::max();
+  };
+
+  // 取消已经计入提交数但不会再被执行的任务
+  void CancelTasks(QueuedTask* items, size_t n) {
+    if (n == 0) {
+      return;
+    }
+    auto error = std::make_exception_ptr(
+        TaskCancelled("thread pool is shut down"));
+    for (size_t i = 0; i < n; ++i) {
+      items[i].task.cancel(error);
+    }
+    external_metrics_.tasks_cancelled.fetch_add(n, std::memory_order_release);
+  }
+
+  // 关闭后才入队的环形队列任务: CancelPending可能已经执行过, 由提交者自己取出并取消
+  void CancelRings() {
+    std::vector<QueuedTask> pending;
+    QueuedTask task;
+    {
+      std::lock_guard<std::mutex> lock(mtx_);
+      for (int i = 0; i < kPriorityLevels; ++i) {
+        while (rings_[i] && rings_[i]->try_pop(task)) {
+          pending.push_back(std::move(task));
+        }
+        lane_pending_[i] = 0;
+      }
+    }
+    CancelTasks(pending.data(), pending.size());
+  }
+
+  template <class F, class... Args>
+  static Task MakeTask(F&& f, Args&&... args) {
+    if constexpr (sizeof...(Args) == 0) {
+      return Task(std::forward<F>(f));
+    } else {
+      return Task(std::bind(std::forward<F>(f), std::forward<Args>(args)...));
+    }
+  }
+
+  TimerId AddTimer(Clock::time_point when, Task task,
+                   std::chrono::nanoseconds period) {
+    std::unique_lock<std::mutex> lock(timer_mtx_);
+    if (Rejecting() || timer_stopped_) {
+      // 和StopTimer一样释放锁之后再取消: 取消可能直接恢复sleep_for中的协程,
+      // 协程捕获异常后再次sleep_for会重新进入这里
+      lock.unlock();
+      task.cancel(std::make_exception_ptr(
+          TaskCancelled("thread pool is shut down")));
+      return TimerId();
+    }
+    if (timer_ == nullptr) {
+      // 定时器线程只负责把到期的任务提交给线程池, 关闭后提交的任务会被取消
+      timer_ = std::make_unique<TimerService>(
+          options_.timer_tick,
+          [this](Task expired) { DispatchTimer(std::move(expired)); },
+          options_.name_prefix + "-timer");
+    }
+    return timer_->Add(when, std::move(task), period);
+  }
+
+  enum class Admission { kAccept, kReject, kCallerRuns };
+
+  // 再提交n个任务时是否过载: 队列长度超过上限, 或者排队时间持续超过目标
+  // 排队时间只在任务出队时更新, 队列空了之后不再有新的样本, 所以队列为空时总是接受任务
+  bool OverloadedFor(size_t n) const {
+    size_t depth = QueueDepth();
+    if (options_.max_queue_depth > 0 && depth + n > options_.max_queue_depth) {
+      return true;
+    }
+    return depth > 0 && overloaded_.load(std::memory_order_relaxed);
+  }
+
+  Admission Admit(size_t n) const {
+    if (options_.overload_policy == OverloadPolicy::kNone || InWorkerThread() ||
+        !OverloadedFor(n)) {
+      return Admission::kAccept;
+    }
+    return options_.overload_policy == OverloadPolicy::kReject
+               ? Admission::kReject
+               : Admission::kCallerRuns;
+  }
+
+  void Reject(Task& task) {
+    external_metrics_.tasks_rejected.fetch_add(1, std::memory_order_relaxed);
+    task.cancel(
+        std::make_exception_ptr(TaskRejected("thread pool is overloaded")));
+  }
+
+  // 不计入提交和完成的任务数, 排空检查只关心队列中的任务
+  // 和RunTask一样记下当前任务, 任务中的CancellationRequested()能看到它的token和截止时间
+  void RunInCaller(Task& task, const TaskOptions& task_options) {
+    external_metrics_.tasks_caller_runs.fetch_add(1, std::memory_order_relaxed);
+    QueuedTask item(std::move(task), task_options.priority, Clock::now(),
+                    task_options.token, task_options.deadline);
+    const QueuedTask* outer = current_task_;
+    current_task_ = &item;
+    item.task();
+    current_task_ = outer;
+  }
+
+  // CoDel式的过载检测, 每个任务出队时用它的排队时间更新:
+  // 排队时间第一次超过目标时记下codel_interval之后的时间点, 到那时排队时间仍然
+  // 一直高于目标, 说明队列中有消化不掉的积压; 只要有一个任务低于目标就恢复正常
+  // 多个线程同时更新时的竞争只会让判断稍有延迟, 不影响正确性
+  void UpdateOverload(Clock::time_point start, Clock::duration wait) {
+    if (options_.target_queue_delay.count() == 0) {
+      return;
+    }
+    if (wait < options_.target_queue_delay) {
+      first_above_ns_.store(0, std::memory_order_relaxed);
+      overloaded_.store(false, std::memory_order_relaxed);
+      return;
+    }
+    int64_t now = std::chrono::duration_cast<std::chrono::nanoseconds>(
+                      start.time_since_epoch())
+                      .count();
+    int64_t first_above = first_above_ns_.load(std::memory_order_relaxed);
+    if (first_above == 0) {
+      first_above_ns_.store(now + options_.codel_interval.count(),
+                            std::memory_order_relaxed);
+    } else if (now >= first_above) {
+      overloaded_.store(true, std::memory_order_relaxed);
+    }
+  }
+
+  // 全局队列和所有本地队列中的任务数
+  size_t QueueDepth() const {
+    int depth = std::max(local_pending_.load(), 0);
+    for (const auto& pending : lane_pending_) {
+      depth += std::max(pending.load(), 0);
+    }
+    return static_cast<size_t>(depth);
+  }
+
+  // 把阻塞型任务转交给阻塞线程池, 第一次提交时才创建它
+  bool PushBlocking(Task task, TaskOptions task_options) {
+    ThreadPool* blocking = blocking_.load();
+    if (blocking == nullptr) {
+      std::lock_guard<std::mutex> lock(blocking_mtx_);
+      if (blocking_stopped_) {
+        task.cancel(std::make_exception_ptr(
+            TaskCancelled("thread pool is shut down")));
+        return false;
+      }
+      if (blocking_pool_ == nullptr) {
+        ThreadPoolOptions options;
+        options.thread_num = options_.blocking_thread_num;
+        options.max_thread_num = options_.max_blocking_thread_num;
+        options.elastic = true;
+        // 阻塞型任务在等待期间一直占着线程, 积压不会自己消化, 所以不等待直接扩容
+        options.grow_delay = std::chrono::nanoseconds(0);
+        options.keep_alive = options_.keep_alive;
+        options.name_prefix = options_.name_prefix + "-io";
+        options.timer_tick = options_.timer_tick;
+        blocking_pool_ = std::make_unique<ThreadPool>(options);
+        blocking_.store(blocking_pool_.get());
+      }
+      blocking = blocking_pool_.get();
+    }
+    task_options.kind = TaskKind::kCompute;
+    return blocking->Execute(std::move(task), task_options);
+  }
+
+  // 关闭阻塞线程池, 剩余的任务被取消; 之后提交的阻塞型任务也直接取消
+  // 阻塞线程池对象保留到本线程池析构, 其他线程可能还在通过blocking_访问它
+  void StopBlocking() {
+    ThreadPool* blocking = nullptr;
+    {
+      std::lock_guard<std::mutex> lock(blocking_mtx_);
+      blocking_stopped_ = true;
+      blocking = blocking_pool_.get();
+    }
+    if (blocking != nullptr) {
+      blocking->Shutdown(ShutdownMode::kAbort);
+    }
+  }
+
+  // 到期的定时任务已经在定时器中等待过, 不再经过准入控制, 更不能在定时器线程中执行
+  void DispatchTimer(Task task) {
+    if (Rejecting()) {
+      task.cancel(std::make_exception_ptr(
+          TaskCancelled("thread pool is shut down")));
+      return;
+    }
+    Push(QueuedTask{std::move(task), TaskPriority::kNormal, Clock::now()});
+  }
+
+  // 停止定时器线程并取消还没到期的定时任务, 之后不会再创建定时器线程
+  void StopTimer() {
+    std::unique_ptr<TimerService> timer;
+    {
+      std::lock_guard<std::mutex> lock(timer_mtx_);
+      timer_stopped_ = true;
+      timer.swap(timer_);
+    }
+    if (timer == nullptr) {
+      return;
+    }
+    auto error = std::make_exception_ptr(
+        TaskCancelled("thread pool is shut down"));
+    for (auto& task : timer->Stop()) {
+      task.cancel(error);
+    }
+  }
+
+  // 已取消或超时时返回对应的异常, 否则返回空
+  static std::exception_ptr CheckCancelled(const CancellationToken& token,
+                                           Clock::time_point deadline) {
+    if (token.IsCancelled()) {
+      return std::make_exception_ptr(TaskCancelled("task cancelled"));
+    }
+    if (deadline != Clock::time_point::max() && Clock::now() >= deadline) {
+      return std::make_exception_ptr(
+          TaskDeadlineExceeded("task deadline exceeded"));
+    }
+    return nullptr;
+  }
+
+  static ThreadPoolOptions MakeOptions(unsigned int thread_num) {
+    ThreadPoolOptions options;
+    options.thread_num = thread_num;
+    return options;
+  }
+
+  static TaskOptions MakeTaskOptions(TaskPriority priority) {
+    TaskOptions task_options;
+    task_options.priority = priority;
+    return task_options;
+  }
+
+  // 只有kNormal优先级的任务才会进入本地队列, 其他优先级的任务总是放入全局队列对应的通道
+  bool PushToLocal(TaskPriority priority) const {
+    return options_.policy == SchedulePolicy::kWorkStealing &&
+           InWorkerThread() &&
+           priority == TaskPriority::kNormal;
+  }
+
+  // 当前线程记录统计数据的位置, 非工作线程共用external_metrics_
+  WorkerMetrics& CurrentMetrics() {
+    return InWorkerThread() ? workers_[local_index_]->metrics
+                            : external_metrics_;
+  }
+
+  // 返回任务是否被接受, 被拒绝的任务已经调用过task.cancel()
+  bool Push(Task task, TaskPriority priority) {
+    return Push(std::move(task), MakeTaskOptions(priority));
+  }
+
+  bool Push(Task task, const TaskOptions& task_options) {
+    if (task_options.kind == TaskKind::kBlocking) {
+      return PushBlocking(std::move(task), task_options);
+    }
+    switch (Admit(1)) {
+      case Admission::kReject:
+        Reject(task);
+        return false;
+      case Admission::kCallerRuns:
+        RunInCaller(task, task_options);
+        return true;
+      case Admission::kAccept:
+        break;
+    }
+    Push(QueuedTask{std::move(task), task_options.priority, Clock::now(),
+                    task_options.token, task_options.deadline});
+    return true;
+  }
+
+  void Push(QueuedTask item) {
+    TaskPriority priority = item.priority;
+    CurrentMetrics().tasks_submitted.fetch_add(1, std::memory_order_relaxed);
+    if (PushToLocal(priority)) {
+      // 工作线程内部提交的任务放入自己的本地队列, 不需要加全局锁
+      local_queue_->push(std::move(item));
+      local_pending_++;
+      // 只有存在挂起的线程时才需要唤醒它来窃取,
+      // 先加锁再通知, 防止挂起线程检查完条件、还没进入等待时错过通知
+      if (sleeping_.load() > 0) {
+        { std::lock_guard<std::mutex> lock(mtx_); }
+        cv_.notify_one();
+      }
+      return;
+    }
+    Wake(1, PushGlobal(&item, 1, static_cast<int>(priority)));
+  }
+
+  bool PushBatch(std::vector<Task>& tasks, TaskPriority priority) {
+    if (tasks.empty()) {
+      return true;
+    }
+    switch (Admit(tasks.size())) {
+      case Admission::kReject:
+        for (auto& task : tasks) {
+          Reject(task);
+        }
+        return false;
+      case Admission::kCallerRuns:
+        for (auto& task : tasks) {
+          RunInCaller(task, MakeTaskOptions(priority));
+        }
+        return true;
+      case Admission::kAccept:
+        break;
+    }
+    int n = static_cast<int>(tasks.size());
+    CurrentMetrics().tasks_submitted.fetch_add(n, std::memory_order_relaxed);
+    std::vector<QueuedTask> items;
+    items.reserve(tasks.size());
+    auto now = Clock::now();
+    for (auto& task : tasks) {
+      items.push_back(QueuedTask{std::move(task), priority, now});
+    }
+    int sleeping = 0;
+    if (PushToLocal(priority)) {
+      local_queue_->push(items.begin(), items.end());
+      local_pending_ += n;
+      if (sleeping_.load() > 0) {
+        std::lock_guard<std::mutex> lock(mtx_);
+        sleeping = sleeping_.load();
+      }
+    } else {
+      sleeping = PushGlobal(items.data(), n, static_cast<int>(priority));
+    }
+    Wake(n, sleeping);
+    return true;
+  }
+
+  // 把n个任务放入全局队列的第lane条通道, 返回挂起的线程数, 用于决定唤醒几个线程
+  // 入队前已经检查过Rejecting(), 但Shutdown可能在检查之后、入队之前完成了排空并
+  // 取消了剩余任务, 所以入队时要再检查一次stop_, 已经停止就直接取消这些任务
+  int PushGlobal(QueuedTask* items, int n, int lane) {
+    if (options_.lock_free_queue) {
+      // 先增加计数再入队, 挂起的线程检查等待条件时只看计数,
+      // 计数与sleeping_都是seq_cst的原子操作: 要么这里看到有线程挂起去唤醒它,
+      // 要么挂起的线程在等待前就看到了新增的计数, 不会丢失唤醒
+      // 通道从空变为非空时重新计时, 否则空闲已久的通道一来新任务就会被当成饿死的通道
+      if (lane_pending_[lane].load() <= 0) {
+        lane_last_pop_ns_[lane].store(NowNs(), std::memory_order_relaxed);
+      }
+      lane_pending_[lane] += n;
+      for (int i = 0; i < n; ++i) {
+        if (!PushRing(lane, items[i])) {
+          lane_pending_[lane] -= n - i;
+          CancelTasks(items + i, n - i);
+          break;
+        }
+      }
+      std::atomic_thread_fence(std::memory_order_seq_cst);
+      if (stop_.load()) {
+        CancelRings();
+        return 0;
+      }
+      if (options_.elastic) {
+        std::lock_guard<std::mutex> lock(mtx_);
+        MaybeGrow();
+      }
+      // 常见情况下没有挂起的线程, 整个提交过程不需要加锁
+      if (sleeping_.load() == 0) {
+        return 0;
+      }
+      std::lock_guard<std::mutex> lock(mtx_);
+      return sleeping_.load();
+    }
+    std::unique_lock<std::mutex> lock(mtx_);
+    // Stop()持有mtx_修改stop_, CancelPending也要加锁才能取走lanes_中的任务
+    if (stop_.load()) {
+      lock.unlock();
+      CancelTasks(items, n);
+      return 0;
+    }
+    for (int i = 0; i < n; ++i) {
+      lanes_[lane].push(std::move(items[i]));
+    }
+    lane_pending_[lane] += n;
+    MaybeGrow();
+    // 持有锁时读取, 此时计入sleeping_的线程都已经在cv_上挂起
+    return sleeping_.load();
+  }
+
+  // 环形队列满时不能无限制地放入新任务, 这就是有界队列的背压(backpressure):
+  // 工作线程直接帮忙执行一个任务腾出空间, 不能阻塞等待, 否则所有线程可能都在等;
+  // 其他线程则让出时间片, 等工作线程消费; 工作线程都已经停止时返回false
+  bool PushRing(int lane, QueuedTask& item) {
+    while (!rings_[lane]->try_push(std::move(item))) {
+      if (stop_.load()) {
+        return false;
+      }
+      if (InWorkerThread()) {
+        RunPendingTask();
+      } else {
+        std::this_thread::yield();
+      }
+    }
+    return true;
+  }
+
+  // 有n个新任务时唤醒挂起的线程, 最多唤醒n个
+  void Wake(int n, int sleeping) {
+    if (sleeping <= 0) {
+      return;
+    }
+    if (n >= sleeping) {
+      cv_.notify_all();
+    } else {
+      for (int i = 0; i < n; ++i) {
+        cv_.notify_one();
+      }
+    }
+  }
+
+  // local_queue_属于当前线程所在的线程池, 在其他线程池的工作线程中Get/Wait时
+  // 不能把那个线程池的任务拿到本线程池来执行
+  bool PopLocal(QueuedTask& task) {
+    if (!InWorkerThread() || local_queue_ == nullptr ||
+        !local_queue_->try_pop(task)) {
+      return false;
+    }
+    local_pending_--;
+    return true;
+  }
+
+  // 全局队列是否为空, 加锁队列模式下需持有mtx_才准确
+  bool GlobalEmpty() const {
+    for (const auto& pending : lane_pending_) {
+      if (pending.load() > 0) {
+        return false;
+      }
+    }
+    return true;
+  }
+
+  // 从全局队列取任务, 需持有mtx_
+  // 老化的做法: 第i条通道的队首任务按 入队时间 + i * 老化阈值 参与比较, 取最早的那个;
+  // 新到的高优先级任务总是先于低优先级任务执行, 但低优先级任务排队超过阈值后,
+  // 就会排到之后才入队的高优先级任务前面, 不会被一直饿死
+  // high_only为true时只看kHigh通道
+  bool PopLane(QueuedTask& task, bool high_only) {
+    auto threshold = std::chrono::nanoseconds(aging_threshold_ns_.load());
+    int lane = -1;
+    Clock::time_point earliest;
+    for (int i = 0; i < (high_only ? 1 : kPriorityLevels); ++i) {
+      if (lanes_[i].empty()) {
+        continue;
+      }
+      auto key = lanes_[i].front().enqueue_time + i * threshold;
+      if (lane < 0 || key < earliest) {
+        lane = i;
+        earliest = key;
+      }
+    }
+    if (lane < 0) {
+      return false;
+    }
+    task = std::move(lanes_[lane].front());
+    lanes_[lane].pop();
+    lane_pending_[lane]--;
+    return true;
+  }
+
+  // 无锁队列模式下从环形队列取任务
+  // 环形队列不能查看队首任务的入队时间, 老化改为按通道上次被取走任务(或者从空变为非空)
+  // 的时间判断, 这个时间不早于队首任务的入队时间:
+  // 第i条通道有任务, 且已经超过 i * 老化阈值 没有被取过, 就先从这条通道取
+  bool PopRings(QueuedTask& task, bool high_only) {
+    if (!high_only) {
+      int64_t now = NowNs();
+      int64_t threshold = aging_threshold_ns_.load();
+      for (int i = kPriorityLevels - 1; i > 0; --i) {
+        if (now - lane_last_pop_ns_[i].load(std::memory_order_relaxed) >=
+                i * threshold &&
+            PopRing(i, task)) {
+          return true;
+        }
+      }
+    }
+    for (int i = 0; i < (high_only ? 1 : kPriorityLevels); ++i) {
+      if (PopRing(i, task)) {
+        return true;
+      }
+    }
+    return false;
+  }
+
+  bool PopRing(int lane, QueuedTask& task) {
+    if (lane_pending_[lane].load() <= 0 || !rings_[lane]->try_pop(task)) {
+      return false;
+    }
+    lane_pending_[lane]--;
+    lane_last_pop_ns_[lane].store(NowNs(), std::memory_order_relaxed);
+    return true;
+  }
+
+  static int64_t NowNs() {
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(
+               Clock::now().time_since_epoch())
+        .count();
+  }
+
+  bool PopGlobal(QueuedTask& task, bool high_only = false) {
+    // 先无锁地检查一下计数, 全局队列为空时不去争抢mtx_
+    if (lane_pending_[0].load() <= 0 &&
+        (high_only ||
+         (lane_pending_[1].load() <= 0 && lane_pending_[2].load() <= 0))) {
+      return false;
+    }
+    if (options_.lock_free_queue) {
+      return PopRings(task, high_only);
+    }
+    std::lock_guard<std::mutex> lock(mtx_);
+    return PopLane(task, high_only);
+  }
+
+  // 依次从 全局kHigh通道 -> 本地队列 -> 全局队列 -> 其他线程的本地队列 中取任务
+  bool TryPop(QueuedTask& task) {
+    return PopGlobal(task, true) || PopLocal(task) || PopGlobal(task) ||
+           Steal(task, InWorkerThread() ? local_index_ : 0);
+  }
+
+  // 从其他线程的本地队列后端窃取任务, 从自己的下一个线程开始找, 避免都去窃取0号线程
+  bool Steal(QueuedTask& task, size_t index) {
+    if (options_.policy != SchedulePolicy::kWorkStealing) {
+      return false;
+    }
+    for (size_t i = 1; i < workers_.size(); ++i) {
+      Worker& victim = *workers_[(index + i) % workers_.size()];
+      if (victim.running.load() && victim.queue.try_steal(task)) {
+        local_pending_--;
+        return true;
+      }
+    }
+    return false;
+  }
+
+  // 执行任务并记录排队时间和执行时间
+  // 任务在Get/Wait中帮忙执行的其他任务, 时间也会算进这个任务的执行时间里
+  // 排队期间被取消或超时的任务不再执行, 计入取消数
+  void RunTask(QueuedTask& task) {
+    WorkerMetrics& metrics = CurrentMetrics();
+    auto start = Clock::now();
+    if (task.token.IsCancelled() || start >= task.deadline) {
+      task.task.cancel(CheckCancelled(task.token, task.deadline));
+      metrics.tasks_cancelled.fetch_add(1, std::memory_order_release);
+      return;
+    }
+    metrics.wait_time[static_cast<int>(task.priority)].Record(
+        start - task.enqueue_time);
+    UpdateOverload(start, start - task.enqueue_time);
+    // 嵌套执行(在Get中帮忙执行其他任务)时, 结束后恢复外层任务
+    const QueuedTask* outer = current_task_;
+    current_task_ = &task;
+    task.task();
+    current_task_ = outer;
+    auto cost = Clock::now() - start;
+    metrics.run_time.Record(cost);
+    metrics.busy_ns.fetch_add(
+        std::chrono::duration_cast<std::chrono::nanoseconds>(cost).count(),
+        std::memory_order_relaxed);
+    metrics.tasks_completed.fetch_add(1, std::memory_order_release);
   }
 
   void Start() {
-    for (int i = 0; i < thread_num_; ++i) {
-      pool_.emplace_back([this]() {
-        while (!this->stop_.load()) {
-          Task task;
-          {
-            std::unique_lock<std::mutex> lock(mtx_);
-            // 等线程池停止，或者任务队列不为空
-            cv_.wait(lock, [this]() {
-              return this->stop_.load() || !tasks_.empty();
-            });
-
-            // 被唤醒后可能是stop为true但任务队列为空, 所以需要再次检查任务队列是否为空
-            if (tasks_.empty()) {
-              return;
-            }
-            task = std::move(tasks_.front());
-            this->tasks_.pop();
-          }                     // 离开作用域释放锁
-          this->thread_num_--;  // 空闲线程数减1
-          task();
-          this->thread_num_++;
+    if (options_.lock_free_queue) {
+      for (int i = 0; i < kPriorityLevels; ++i) {
+        rings_[i] = std::make_unique<mpmc_bounded_queue<QueuedTask>>(
+            options_.queue_capacity);
+        lane_last_pop_ns_[i] = NowNs();
+      }
+    }
+    size_t slot_num =
+        options_.elastic ? options_.max_thread_num : options_.thread_num;
+    for (size_t i = 0; i < slot_num; ++i) {
+      workers_.emplace_back(std::make_unique<Worker>());
+    }
+    std::error_code ec;
+    {
+      std::lock_guard<std::mutex> lock(mtx_);
+      for (size_t i = 0; i < options_.thread_num && !ec; ++i) {
+        ec = SpawnWorker(i);
+      }
+    }
+    if (ec) {
+      Stop();
+      throw std::system_error(ec, "ThreadPool: set thread attributes");
+    }
+  }
+
+  // 在第index个槽位上启动工作线程, 需持有mtx_
+  std::error_code SpawnWorker(size_t index) {
+    Worker& worker = *workers_[index];
+    if (worker.td.joinable()) {
+      // 槽位上之前的线程已经退出(退出前会先释放mtx_), 这里join很快
+      worker.td.join();
+    }
+    worker.running = true;
+    live_num_++;
+    thread_num_++;
+    worker.td = std::thread([this, index]() { WorkerLoop(index); });
+    return SetThreadAttributes(worker.td, static_cast<int>(index));
+  }
+
+  // 全局队列积压的任务是否超出空闲线程能消化的数量
+  // 被唤醒但还没来得及取任务的线程也算空闲, 所以用 积压数 - 空闲数 来判断
+  bool Backlogged() const {
+    size_t depth = 0;
+    for (const auto& pending : lane_pending_) {
+      depth += static_cast<size_t>(std::max(pending.load(), 0));
+    }
+    size_t idle = static_cast<size_t>(std::max(thread_num_.load(), 0));
+    return depth >= idle + options_.grow_queue_depth;
+  }
+
+  // 弹性模式下, 积压持续了grow_delay时新建一个线程, 需持有mtx_
+  // 提交任务时检查一次; 突发提交结束后积压可能还在, 工作线程执行完任务后也会在
+  // 积压持续够久时来检查, 见GrowDue
+  void MaybeGrow() {
+    if (!options_.elastic || stop_.load() ||
+        live_num_.load() >= static_cast<int>(options_.max_thread_num)) {
+      return;
+    }
+    if (!Backlogged()) {
+      backlog_since_ns_.store(0, std::memory_order_relaxed);
+      return;
+    }
+    int64_t now = NowNs();
+    int64_t since = backlog_since_ns_.load(std::memory_order_relaxed);
+    if (since == 0) {
+      backlog_since_ns_.store(now, std::memory_order_relaxed);
+      since = now;
+    }
+    if (now - since < options_.grow_delay.count()) {
+      return;
+    }
+    for (size_t i = 0; i < workers_.size(); ++i) {
+      if (!workers_[i]->running.load()) {
+        // 新线程设置线程名、绑核失败不影响执行任务, 忽略错误
+        SpawnWorker(i);
+        // 重新计时, 积压还在的话再过grow_delay才加下一个线程
+        backlog_since_ns_.store(now, std::memory_order_relaxed);
+        return;
+      }
+    }
+  }
+
+  // 之前观察到的积压是否已经持续了grow_delay, 不加锁, 为true时再加锁调用MaybeGrow
+  bool GrowDue() const {
+    if (!options_.elastic) {
+      return false;
+    }
+    int64_t since = backlog_since_ns_.load(std::memory_order_relaxed);
+    return since != 0 && NowNs() - since >= options_.grow_delay.count();
+  }
+
+  // kSpinThenPark策略下, 挂起前先自旋再让出时间片, 等到任务返回true
+  // 自旋的线程不计入sleeping_, 提交任务时不需要加锁去唤醒它们
+  template <typename Pred>
+  bool SpinForWork(Pred ready) {
+    if (options_.wait_strategy != WaitStrategy::kSpinThenPark) {
+      return false;
+    }
+    for (int i = 0; i < options_.spin_count; ++i) {
+      if (ready()) {
+        return true;
+      }
+      CpuRelax();
+    }
+    for (int i = 0; i < options_.yield_count; ++i) {
+      if (ready()) {
+        return true;
+      }
+      std::this_thread::yield();
+    }
+    return false;
+  }
+
+  static void AddIdleTime(WorkerMetrics& metrics, Clock::time_point start) {
+    metrics.idle_ns.fetch_add(
+        std::chrono::duration_cast<std::chrono::nanoseconds>(Clock::now() -
+                                                             start)
+            .count(),
+        std::memory_order_relaxed);
+  }
+
+  void WorkerLoop(size_t index) {
+    local_owner_ = this;
+    local_index_ = index;
+    if (options_.policy == SchedulePolicy::kWorkStealing) {
+      local_queue_ = &workers_[index]->queue;
+    }
+    WorkerMetrics& metrics = workers_[index]->metrics;
+    auto ready = [this]() {
+      return this->stop_.load() || !GlobalEmpty() || local_pending_.load() > 0;
+    };
+    while (!this->stop_.load()) {
+      QueuedTask task;
+      if (TryPop(task)) {
+        this->thread_num_--;  // 空闲线程数减1
+        RunTask(task);
+        this->thread_num_++;
+        if (GrowDue()) {
+          std::lock_guard<std::mutex> lock(mtx_);
+          MaybeGrow();
         }
-      });
+        continue;
+      }
+      auto idle_start = Clock::now();
+      if (SpinForWork(ready)) {
+        AddIdleTime(metrics, idle_start);
+        continue;
+      }
+      std::unique_lock<std::mutex> lock(mtx_);
+      if (shutdown_.load()) {
+        drain_cv_.notify_all();  // 正在关闭, 通知Shutdown检查是否已经排空
+      }
+      sleeping_++;
+      // 等线程池停止，或者全局队列、某个本地队列不为空
+      bool timeout = false;
+      if (options_.elastic) {
+        timeout = !cv_.wait_for(lock, options_.keep_alive, ready);
+      } else {
+        cv_.wait(lock, ready);
+      }
+      sleeping_--;
+      AddIdleTime(metrics, idle_start);
+      // 弹性模式下空闲超过keep_alive, 且线程数多于thread_num时退出;
+      // 此时本地队列一定是空的, 因为只有线程自己会往本地队列里放任务
+      if (timeout &&
+          live_num_.load() > static_cast<int>(options_.thread_num)) {
+        workers_[index]->running = false;
+        live_num_--;
+        thread_num_--;
+        break;
+      }
+      // 被唤醒后可能是stop为true但任务队列为空, 回到循环开头再检查一次
+    }
+    local_owner_ = nullptr;
+    local_queue_ = nullptr;
+    local_index_ = 0;
+  }
+
+  // 设置线程名和CPU亲和性, 使用pthread_setname_np/pthread_setaffinity_np,
+  // 非Linux平台上什么也不做
+  std::error_code SetThreadAttributes(std::thread& td, int index) {
+#ifdef __linux__
+    std::string name = options_.name_prefix + "-" + std::to_string(index);
+    name.resize(std::min<size_t>(name.size(), 15));
+    // 设置线程名失败不影响使用, 忽略错误
+    pthread_setname_np(td.native_handle(), name.c_str());
+
+    if (!options_.cpu_affinity.empty()) {
+      cpu_set_t cpuset;
+      CPU_ZERO(&cpuset);
+      for (int cpu : options_.cpu_affinity) {
+        if (cpu < 0 || cpu >= CPU_SETSIZE) {
+          return std::make_error_code(std::errc::invalid_argument);
+        }
+        CPU_SET(cpu, &cpuset);
+      }
+      int err = pthread_setaffinity_np(td.native_handle(), sizeof(cpuset),
+                                       &cpuset);
+      if (err != 0) {
+        return std::error_code(err, std::generic_category());
+      }
     }
+#endif
+    return std::error_code();
   }
 
   void Stop() {
-    stop_.store(true);
+    {
+      // 加锁修改, 避免线程检查完等待条件、还没挂起时错过通知
+      std::lock_guard<std::mutex> lock(mtx_);
+      stop_.store(true);
+    }
     cv_.notify_all();  // 通知所有线程
-    for (auto& td : pool_) {
-      if (td.joinable()) {
-        std::cout << "join thread " << td.get_id() << std::endl;
-        td.join();
+    // stop_置为true之后不会再创建新线程, 可以不加锁遍历
+    for (auto& worker : workers_) {
+      if (worker->td.joinable()) {
+        worker->td.join();
       }
     }
   }
@@ -103,10 +1446,57 @@ class ThreadPool {
  private:
   std::mutex mtx_;  // 保护任务队列
   std::condition_variable cv_;
-  std::atomic_bool stop_;
-  std::atomic_int thread_num_;  // 空闲的线程数
-  std::queue<Task> tasks_;
-  std::vector<std::thread> pool_;
+  std::atomic_bool stop_;  // 工作线程退出
+  std::atomic_bool shutdown_{false};  // 不再接受外部提交的任务
+  std::condition_variable drain_cv_;
+  std::atomic_int thread_num_{0};  // 空闲的线程数
+  std::queue<QueuedTask> lanes_[kPriorityLevels];  // 全局队列, 由mtx_保护
+  std::atomic_int lane_pending_[kPriorityLevels] = {};  // 各通道的任务数
+  // 无锁队列模式下代替lanes_的环形队列, 以及各通道上次被取走任务的时间
+  std::unique_ptr<mpmc_bounded_queue<QueuedTask>> rings_[kPriorityLevels];
+  std::atomic<int64_t> lane_last_pop_ns_[kPriorityLevels] = {};
+
+  // 默认老化阈值100ms
+  std::atomic<int64_t> aging_threshold_ns_{100 * 1000 * 1000};
+
+  ThreadPoolOptions options_;
+
+  // 工作线程的槽位, 弹性模式下按最大线程数预先分配, 线程退出后槽位可以复用;
+  // 槽位本身不会增删, 窃取任务时可以不加锁遍历
+  struct Worker {
+    std::thread td;
+    work_stealing_queue<QueuedTask> queue;  // 工作窃取模式下的本地队列
+    std::atomic_bool running{false};
+    WorkerMetrics metrics;  // 线程退出后保留, 槽位复用时继续累加
+  };
+  std::vector<std::unique_ptr<Worker>> workers_;
+  WorkerMetrics external_metrics_;  // 非工作线程提交、执行任务的统计
+  std::atomic_int live_num_{0};  // 存活的工作线程数
+  std::atomic_int local_pending_{0};  // 所有本地队列中的任务总数
+  std::atomic_int sleeping_{0};       // 挂起在cv_上的线程数
+  std::atomic<int64_t> backlog_since_ns_{0};  // 弹性模式下积压开始的时间, 0表示没有积压
+
+  std::mutex timer_mtx_;  // 保护timer_的创建和销毁
+  std::unique_ptr<TimerService> timer_;
+  bool timer_stopped_ = false;
+
+  std::mutex blocking_mtx_;  // 保护blocking_pool_的创建
+  std::unique_ptr<ThreadPool> blocking_pool_;  // 执行阻塞型任务的伴随线程池
+  std::atomic<ThreadPool*> blocking_{nullptr};
+  bool blocking_stopped_ = false;
+
+  // CoDel式过载检测的状态, 见UpdateOverload
+  std::atomic<int64_t> first_above_ns_{0};
+  std::atomic_bool overloaded_{false};
+
+  // 线程局部变量, 记录当前线程所属的线程池、它的槽位下标和本地队列,
+  // 非工作线程中它们为nullptr
+  inline static thread_local ThreadPool* local_owner_ = nullptr;
+  inline static thread_local work_stealing_queue<QueuedTask>* local_queue_ =
+      nullptr;
+  inline static thread_local size_t local_index_ = 0;
+  // 当前线程正在执行的任务, 供CancellationRequested()检查
+  inline static thread_local const QueuedTask* current_task_ = nullptr;
 };
 
 #endif  // thread_pool_h_
@@ -0,0 +1,278 @@
+#ifndef thread_pool_bench_h_
+#define thread_pool_bench_h_
+#include <atomic>
+#include <chrono>
+#include <functional>
+#include <future>
+#include <iostream>
+#include <memory>
+#include <numeric>
+#include <thread>
+#include <vector>
+
+#include "parallel_algorithm.h"
+#include "thread_pool.h"
+
+// 线程池性能测试, 结果和机器核数关系很大, 只用来对比不同实现之间的相对差距
+
+// 提交task_num个任务, 等全部执行完, 返回每秒处理的任务数
+// submit(done)负责提交一个任务, 任务执行时要把done加1
+template <typename SubmitFn>
+double measure_tasks_per_second(int task_num, SubmitFn submit) {
+  std::atomic<int> done{0};
+  auto start = std::chrono::steady_clock::now();
+  for (int i = 0; i < task_num; ++i) {
+    submit(done);
+  }
+  while (done.load() < task_num) {
+    std::this_thread::yield();
+  }
+  std::chrono::duration<double> cost = std::chrono::steady_clock::now() - start;
+  return task_num / cost.count();
+}
+
+// 对比三种提交方式的吞吐量:
+// 1. 以前Commit的实现: make_shared<std::packaged_task> + std::bind,
+//    再包一层std::packaged_task<void()>, 每个任务5次左右堆内存分配
+// 2. 现在的Commit: 绑定后的函数和std::promise直接放在任务内部,
+//    只剩promise共享状态的分配
+// 3. Post: 不需要返回值, 小任务没有堆内存分配
+void bench_thread_pool_commit() {
+  const int kTaskNum = 200000;
+  auto& pool = ThreadPool::instance();
+
+  double legacy = measure_tasks_per_second(kTaskNum, [&](std::atomic<int>& done) {
+    auto task = std::make_shared<std::packaged_task<void()>>(
+        std::bind([&done]() { done++; }));
+    std::future<void> fut = task->get_future();
+    pool.Post(std::packaged_task<void()>([task] { (*task)(); }));
+  });
+
+  double commit = measure_tasks_per_second(kTaskNum, [&](std::atomic<int>& done) {
+    std::future<void> fut = pool.Commit([&done]() { done++; });
+  });
+
+  double post = measure_tasks_per_second(
+      kTaskNum, [&](std::atomic<int>& done) { pool.Post([&done]() { done++; }); });
+
+  std::cout << "legacy commit: " << legacy << " tasks/s" << std::endl;
+  std::cout << "commit:        " << commit << " tasks/s" << std::endl;
+  std::cout << "post:          " << post << " tasks/s" << std::endl;
+}
+
+// 对比逐个Post和PostBatch一次提交kBatchSize个任务的吞吐量
+void bench_thread_pool_batch() {
+  const int kBatchSize = 256;
+  const int kTaskNum = kBatchSize * 800;
+  auto& pool = ThreadPool::instance();
+  std::atomic<int> done{0};
+  auto task = [&done]() { done++; };
+  std::vector<decltype(task)> batch(kBatchSize, task);
+
+  auto measure = [&](auto submit_all) {
+    done = 0;
+    auto start = std::chrono::steady_clock::now();
+    submit_all();
+    while (done.load() < kTaskNum) {
+      std::this_thread::yield();
+    }
+    std::chrono::duration<double> cost =
+        std::chrono::steady_clock::now() - start;
+    return kTaskNum / cost.count();
+  };
+
+  double single = measure([&]() {
+    for (int i = 0; i < kTaskNum; ++i) {
+      pool.Post(task);
+    }
+  });
+  double batched = measure([&]() {
+    for (int i = 0; i < kTaskNum; i += kBatchSize) {
+      pool.PostBatch(batch.begin(), batch.end());
+    }
+  });
+
+  std::cout << "post one by one: " << single << " tasks/s" << std::endl;
+  std::cout << "post batch:      " << batched << " tasks/s" << std::endl;
+}
+
+// 对比全局队列使用 std::mutex + std::queue 和无锁环形队列时,
+// 多个线程同时提交任务的吞吐量
+void bench_thread_pool_queue() {
+  const int kProducerNum = 4;
+  const int kTaskPerProducer = 50000;
+  auto measure = [&](bool lock_free) {
+    ThreadPoolOptions options;
+    options.lock_free_queue = lock_free;
+    // 容量太小时生产者会因为背压等待, 测的就不是队列本身的开销了
+    options.queue_capacity = 1 << 16;
+    ThreadPool pool(options);
+    std::atomic<int> done{0};
+    auto start = std::chrono::steady_clock::now();
+    std::vector<std::thread> producers;
+    for (int i = 0; i < kProducerNum; ++i) {
+      producers.emplace_back([&]() {
+        for (int j = 0; j < kTaskPerProducer; ++j) {
+          pool.Post([&done]() { done++; });
+        }
+      });
+    }
+    for (auto& td : producers) {
+      td.join();
+    }
+    while (done.load() < kProducerNum * kTaskPerProducer) {
+      std::this_thread::yield();
+    }
+    std::chrono::duration<double> cost =
+        std::chrono::steady_clock::now() - start;
+    return kProducerNum * kTaskPerProducer / cost.count();
+  };
+  double locked = measure(false);
+  double lock_free = measure(true);
+  std::cout << "mutex queue:     " << locked << " tasks/s" << std::endl;
+  std::cout << "lock-free queue: " << lock_free << " tasks/s" << std::endl;
+}
+
+// 忙等一段时间, 模拟占用CPU的任务
+void busy_for(std::chrono::microseconds d) {
+  auto end = std::chrono::steady_clock::now() + d;
+  while (std::chrono::steady_clock::now() < end) {
+  }
+}
+
+void print_wait_time(const char* name, const LatencyHistogram& h) {
+  std::cout << name << " count " << h.Count() << ", wait p50 "
+            << h.Percentile(50) / 1000 << "us, p99 " << h.Percentile(99) / 1000
+            << "us, max " << h.Max() / 1000 << "us" << std::endl;
+}
+
+// 先用大量后台任务把线程池占满, 再陆续提交高优先级任务,
+// 对比各通道任务的排队时间, 高优先级任务的p99应该远小于后台任务
+void bench_thread_pool_priority() {
+  auto& pool = ThreadPool::instance();
+  std::vector<std::function<void()>> background(
+      20000, []() { busy_for(std::chrono::microseconds(50)); });
+  pool.PostBatch(background.begin(), background.end(),
+                 TaskPriority::kBackground);
+
+  std::vector<std::future<void>> high;
+  for (int i = 0; i < 500; ++i) {
+    high.push_back(pool.Commit(TaskPriority::kHigh, []() {
+      busy_for(std::chrono::microseconds(10));
+    }));
+    std::this_thread::sleep_for(std::chrono::microseconds(200));
+  }
+  for (auto& fut : high) {
+    fut.get();
+  }
+  print_wait_time("high      ", pool.WaitTime(TaskPriority::kHigh));
+  print_wait_time("normal    ", pool.WaitTime(TaskPriority::kNormal));
+  print_wait_time("background", pool.WaitTime(TaskPriority::kBackground));
+}
+
+// 对比不同等待策略下任务从提交到开始执行的延迟
+// 每次提交后等任务执行完, 再空闲一小段时间, 模拟请求/响应类负载中短暂的空闲
+void bench_thread_pool_wakeup() {
+  const int kRounds = 2000;
+  auto measure = [&](WaitStrategy strategy, const char* name) {
+    ThreadPoolOptions options;
+    options.thread_num = 2;
+    options.wait_strategy = strategy;
+    ThreadPool pool(options);
+    LatencyHistogram latency;
+    for (int i = 0; i < kRounds; ++i) {
+      std::atomic_bool done{false};
+      auto submit_time = std::chrono::steady_clock::now();
+      pool.Post([&]() {
+        latency.Record(std::chrono::steady_clock::now() - submit_time);
+        done = true;
+      });
+      while (!done.load()) {
+        std::this_thread::yield();
+      }
+      busy_for(std::chrono::microseconds(20));
+    }
+    std::cout << name << " submit-to-start p50 " << latency.Percentile(50)
+              << "ns, p99 " << latency.Percentile(99) << "ns" << std::endl;
+  };
+  measure(WaitStrategy::kBlock, "block         ");
+  measure(WaitStrategy::kSpinThenPark, "spin-then-park");
+}
+
+// chapter2中parallel_accumulate的做法: 每次调用都创建线程, 按线程数等分数据
+template <typename Iterator, typename T>
+T thread_per_call_accumulate(Iterator first, Iterator last, T init) {
+  size_t length = std::distance(first, last);
+  size_t num_threads = std::max(1u, std::thread::hardware_concurrency());
+  size_t block_size = length / num_threads;
+  std::vector<T> results(num_threads);
+  std::vector<std::thread> threads;
+  Iterator block_start = first;
+  for (size_t i = 0; i + 1 < num_threads; ++i) {
+    Iterator block_end = block_start + block_size;
+    threads.emplace_back([block_start, block_end, &results, i]() {
+      results[i] = std::accumulate(block_start, block_end, T());
+    });
+    block_start = block_end;
+  }
+  results[num_threads - 1] = std::accumulate(block_start, last, T());
+  for (auto& td : threads) {
+    td.join();
+  }
+  return std::accumulate(results.begin(), results.end(), init);
+}
+
+// 1. 循环中反复对中等规模的数据求和: 每次创建线程 vs 在线程池上parallel_reduce
+// 2. 每个元素耗时不均匀(越往后越耗时): 等长分块 vs guided自适应分块
+void bench_parallel_reduce() {
+  const int kRounds = 2000;
+  std::vector<long long> nums(100000, 1);
+  auto& pool = ThreadPool::instance();
+
+  auto measure = [](auto fn) {
+    auto start = std::chrono::steady_clock::now();
+    fn();
+    std::chrono::duration<double, std::milli> cost =
+        std::chrono::steady_clock::now() - start;
+    return cost.count();
+  };
+  long long check = 0;
+  double threads_ms = measure([&]() {
+    for (int i = 0; i < kRounds; ++i) {
+      check += thread_per_call_accumulate(nums.begin(), nums.end(), 0LL);
+    }
+  });
+  double pool_ms = measure([&]() {
+    for (int i = 0; i < kRounds; ++i) {
+      check += parallel_reduce(pool, nums.begin(), nums.end(), 0LL,
+                               std::plus<long long>(), 1024);
+    }
+  });
+  std::cout << "reduce x" << kRounds << ", thread per call: " << threads_ms
+            << "ms, parallel_reduce: " << pool_ms << "ms (" << check << ")"
+            << std::endl;
+
+  const int kItems = 2000;
+  auto cost_of = [](int i) { return std::chrono::microseconds(i / 20); };
+  double static_ms = measure([&]() {
+    size_t num_threads = pool.ThreadCount();
+    size_t block_size = (kItems + num_threads - 1) / num_threads;
+    TaskGroup group(pool);
+    for (size_t t = 0; t < num_threads; ++t) {
+      group.Run([&, t]() {
+        size_t end = std::min<size_t>(kItems, (t + 1) * block_size);
+        for (size_t i = t * block_size; i < end; ++i) {
+          busy_for(cost_of(static_cast<int>(i)));
+        }
+      });
+    }
+    group.Wait();
+  });
+  double guided_ms = measure([&]() {
+    parallel_for(pool, 0, kItems, [&](int i) { busy_for(cost_of(i)); });
+  });
+  std::cout << "uneven for, equal blocks: " << static_ms
+            << "ms, guided: " << guided_ms << "ms" << std::endl;
+}
+
+#endif  // thread_pool_bench_h_
@@ -0,0 +1,135 @@
+#ifndef thread_pool_metrics_h_
+#define thread_pool_metrics_h_
+#include <atomic>
+#include <cstdint>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#include "latency_histogram.h"
+
+// 线程池的运行统计
+// 1. 每个工作线程各自累加自己的计数器和直方图(WorkerMetrics), 写的时候互不竞争,
+//    读取时再把所有线程的数据合并成一个快照(ThreadPoolMetrics)
+// 2. 计数器都用relaxed内存序, 快照不是严格一致的, 只用于观察和调优
+
+// 单个线程的统计数据, 按缓存行对齐, 避免不同线程的计数器落在同一缓存行上产生伪共享
+struct alignas(64) WorkerMetrics {
+  static constexpr int kLaneNum = 3;  // 与TaskPriority的通道数一致
+
+  std::atomic<uint64_t> tasks_submitted{0};
+  std::atomic<uint64_t> tasks_completed{0};
+  std::atomic<uint64_t> tasks_cancelled{0};  // 没有执行就被取消的任务数
+  std::atomic<uint64_t> tasks_rejected{0};   // 过载时被拒绝的任务数
+  std::atomic<uint64_t> tasks_caller_runs{0};  // 过载时在提交线程中执行的任务数
+  std::atomic<uint64_t> busy_ns{0};  // 执行任务的总时间
+  std::atomic<uint64_t> idle_ns{0};  // 挂起等待任务的总时间
+  LatencyHistogram wait_time[kLaneNum];  // 各通道任务从入队到开始执行的时间
+  LatencyHistogram run_time;             // 任务的执行时间
+};
+
+// 线程池统计数据的快照
+struct ThreadPoolMetrics {
+  struct WorkerStats {
+    bool running = false;
+    uint64_t tasks_completed = 0;
+    uint64_t busy_ns = 0;
+    uint64_t idle_ns = 0;
+  };
+
+  std::string name;
+  uint64_t tasks_submitted = 0;
+  uint64_t tasks_completed = 0;
+  uint64_t tasks_cancelled = 0;
+  uint64_t tasks_rejected = 0;
+  uint64_t tasks_caller_runs = 0;
+  bool overloaded = false;
+  size_t queue_depth = 0;  // 全局队列和所有本地队列中的任务数
+  size_t lane_depth[WorkerMetrics::kLaneNum] = {};  // 全局队列各通道的任务数
+  int live_threads = 0;
+  int idle_threads = 0;
+  LatencyHistogram wait_time;  // 所有通道合并后的排队时间
+  LatencyHistogram lane_wait_time[WorkerMetrics::kLaneNum];
+  LatencyHistogram run_time;
+  std::vector<WorkerStats> workers;
+
+  // 把一个线程的数据累加进快照, external为true表示非工作线程(比如在Get中帮忙执行任务的线程)
+  void Merge(const WorkerMetrics& m, bool running, bool external) {
+    tasks_submitted += m.tasks_submitted.load(std::memory_order_relaxed);
+    tasks_completed += m.tasks_completed.load(std::memory_order_relaxed);
+    tasks_cancelled += m.tasks_cancelled.load(std::memory_order_relaxed);
+    tasks_rejected += m.tasks_rejected.load(std::memory_order_relaxed);
+    tasks_caller_runs += m.tasks_caller_runs.load(std::memory_order_relaxed);
+    for (int i = 0; i < WorkerMetrics::kLaneNum; ++i) {
+      lane_wait_time[i].Merge(m.wait_time[i]);
+      wait_time.Merge(m.wait_time[i]);
+    }
+    run_time.Merge(m.run_time);
+    if (!external) {
+      WorkerStats stats;
+      stats.running = running;
+      stats.tasks_completed = m.tasks_completed.load(std::memory_order_relaxed);
+      stats.busy_ns = m.busy_ns.load(std::memory_order_relaxed);
+      stats.idle_ns = m.idle_ns.load(std::memory_order_relaxed);
+      workers.push_back(stats);
+    }
+  }
+
+  // 输出成Prometheus的文本格式, 方便直接被采集
+  std::string ToString() const {
+    static const char* kLaneNames[WorkerMetrics::kLaneNum] = {"high", "normal",
+                                                              "background"};
+    std::ostringstream os;
+    std::string pool = "pool=\"" + name + "\"";
+    os << "threadpool_tasks_submitted_total{" << pool << "} " << tasks_submitted
+       << "\n";
+    os << "threadpool_tasks_completed_total{" << pool << "} " << tasks_completed
+       << "\n";
+    os << "threadpool_tasks_cancelled_total{" << pool << "} " << tasks_cancelled
+       << "\n";
+    os << "threadpool_tasks_rejected_total{" << pool << "} " << tasks_rejected
+       << "\n";
+    os << "threadpool_tasks_caller_runs_total{" << pool << "} "
+       << tasks_caller_runs << "\n";
+    os << "threadpool_overloaded{" << pool << "} " << overloaded << "\n";
+    os << "threadpool_queue_depth{" << pool << "} " << queue_depth << "\n";
+    for (int i = 0; i < WorkerMetrics::kLaneNum; ++i) {
+      os << "threadpool_lane_depth{" << pool << ",lane=\"" << kLaneNames[i]
+         << "\"} " << lane_depth[i] << "\n";
+    }
+    os << "threadpool_threads{" << pool << ",state=\"live\"} " << live_threads
+       << "\n";
+    os << "threadpool_threads{" << pool << ",state=\"idle\"} " << idle_threads
+       << "\n";
+    for (int i = 0; i < WorkerMetrics::kLaneNum; ++i) {
+      std::string labels = pool + ",lane=\"" + kLaneNames[i] + "\"";
+      WriteHistogram(os, "threadpool_wait_time_ns", labels, lane_wait_time[i]);
+    }
+    WriteHistogram(os, "threadpool_run_time_ns", pool, run_time);
+    for (size_t i = 0; i < workers.size(); ++i) {
+      std::string labels = pool + ",worker=\"" + std::to_string(i) + "\"";
+      os << "threadpool_worker_tasks_completed_total{" << labels << "} "
+         << workers[i].tasks_completed << "\n";
+      os << "threadpool_worker_busy_ns_total{" << labels << "} "
+         << workers[i].busy_ns << "\n";
+      os << "threadpool_worker_idle_ns_total{" << labels << "} "
+         << workers[i].idle_ns << "\n";
+    }
+    return os.str();
+  }
+
+ private:
+  static void WriteHistogram(std::ostringstream& os, const std::string& metric,
+                             const std::string& labels,
+                             const LatencyHistogram& h) {
+    static const double kQuantiles[] = {50, 90, 99, 99.9};
+    for (double q : kQuantiles) {
+      os << metric << "{" << labels << ",quantile=\"" << q / 100 << "\"} "
+         << h.Percentile(q) << "\n";
+    }
+    os << metric << "_sum{" << labels << "} " << h.Sum() << "\n";
+    os << metric << "_count{" << labels << "} " << h.Count() << "\n";
+  }
+};
+
+#endif  // thread_pool_metrics_h_
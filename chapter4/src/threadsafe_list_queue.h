@@ -0,0 +1,125 @@
+#ifndef threadsafe_list_queue_h_
+#define threadsafe_list_queue_h_
+#include <atomic>
+#include <condition_variable>
+#include <memory>
+#include <mutex>
+
+// 细粒度锁版本的线程安全队列, 接口与threadsafe_queue相同
+// threadsafe_queue用一个互斥锁保护整个std::queue, 入队和出队互相竞争同一把锁;
+// 这里用单链表实现, 头尾各用一个互斥锁:
+// 1. 链表末尾始终有一个不存数据的虚拟节点(dummy node), tail指向它;
+//    push把数据放进当前的虚拟节点, 再挂上一个新的虚拟节点, 只需要修改tail
+// 2. pop只修改head, 队列为空时head == tail, 所以pop只在比较head和tail时
+//    短暂地持有tail_mutex, 入队和出队绝大部分时间可以并行
+// 3. 数据用shared_ptr<T>保存, 在加锁前就分配好内存, 缩短持锁时间,
+//    pop返回shared_ptr时也不需要再拷贝一次
+template <typename T>
+class threadsafe_list_queue {
+ private:
+  struct node {
+    std::shared_ptr<T> data;
+    std::unique_ptr<node> next;
+  };
+
+  std::mutex head_mutex;
+  std::unique_ptr<node> head;
+  std::mutex tail_mutex;
+  node* tail;
+  std::condition_variable data_cond;
+  std::atomic<int> waiters{0};  // 挂起等待数据的线程数, 在head_mutex下修改
+
+  node* get_tail() {
+    std::lock_guard<std::mutex> tail_lock(tail_mutex);
+    return tail;
+  }
+
+  // 调用前需要持有head_mutex, 且队列不为空
+  std::unique_ptr<node> pop_head() {
+    std::unique_ptr<node> old_head = std::move(head);
+    head = std::move(old_head->next);
+    return old_head;
+  }
+
+  std::unique_ptr<node> try_pop_head() {
+    std::lock_guard<std::mutex> head_lock(head_mutex);
+    if (head.get() == get_tail()) {
+      return std::unique_ptr<node>();
+    }
+    return pop_head();
+  }
+
+  std::unique_ptr<node> wait_pop_head() {
+    std::unique_lock<std::mutex> head_lock(head_mutex);
+    if (head.get() == get_tail()) {
+      waiters++;
+      data_cond.wait(head_lock, [this]() { return head.get() != get_tail(); });
+      waiters--;
+    }
+    return pop_head();
+  }
+
+ public:
+  threadsafe_list_queue() : head(new node), tail(head.get()) {}
+  threadsafe_list_queue(const threadsafe_list_queue&) = delete;
+  threadsafe_list_queue& operator=(const threadsafe_list_queue&) = delete;
+
+  // 节点逐个释放, 避免unique_ptr链式析构在很长的队列上递归过深
+  ~threadsafe_list_queue() {
+    while (head) {
+      head = std::move(head->next);
+    }
+  }
+
+  bool empty() {
+    std::lock_guard<std::mutex> head_lock(head_mutex);
+    return head.get() == get_tail();
+  }
+
+  void push(T new_value) {
+    // 内存分配和数据的移动都在锁外完成
+    std::shared_ptr<T> new_data(std::make_shared<T>(std::move(new_value)));
+    std::unique_ptr<node> p(new node);
+    {
+      std::lock_guard<std::mutex> tail_lock(tail_mutex);
+      tail->data = new_data;
+      node* const new_tail = p.get();
+      tail->next = std::move(p);
+      tail = new_tail;
+    }
+    // 等待方在head_mutex下检查条件, 而这里没有持有head_mutex, 有线程在等待时要先加锁
+    // 再通知, 防止等待方检查完条件、还没挂起时错过通知; 没有等待的线程时不碰head_mutex,
+    // 生产者和消费者互不干扰
+    // 等待方先增加waiters再加tail_mutex读tail: 如果它读到的是旧的tail, 说明它的
+    // tail_mutex加锁在这里之前, waiters的增加对这里一定可见
+    if (waiters.load() > 0) {
+      { std::lock_guard<std::mutex> head_lock(head_mutex); }
+      data_cond.notify_one();
+    }
+  }
+
+  bool try_pop(T& value) {
+    std::unique_ptr<node> old_head = try_pop_head();
+    if (!old_head) {
+      return false;
+    }
+    value = std::move(*old_head->data);
+    return true;
+  }
+
+  std::shared_ptr<T> try_pop() {
+    std::unique_ptr<node> old_head = try_pop_head();
+    return old_head ? old_head->data : std::shared_ptr<T>();
+  }
+
+  void wait_and_pop(T& value) {
+    std::unique_ptr<node> old_head = wait_pop_head();
+    value = std::move(*old_head->data);
+  }
+
+  std::shared_ptr<T> wait_and_pop() {
+    std::unique_ptr<node> old_head = wait_pop_head();
+    return old_head->data;
+  }
+};
+#endif  // threadsafe_list_queue_h_
@@ -1,10 +1,24 @@
 #ifndef threadsafe_queue_h_
 #define threadsafe_queue_h_
+#include <chrono>
 #include <condition_variable>
+#include <cstddef>
 #include <memory>
 #include <mutex>
 #include <queue>
+#include <utility>
 
+// 元素可以是只能移动的类型(比如std::unique_ptr): push和pop都是移动而不是拷贝,
+// 拷贝构造函数只有在被使用时才要求T可拷贝
+// 传引用的try_pop/wait_and_pop不分配内存, 返回shared_ptr的版本要为结果分配一次内存
+//
+// 有界模式: 构造时指定capacity, 队列满时push阻塞等待消费者取走元素(背压),
+// 生产者再快内存占用也不会超过capacity个元素; capacity为0表示无界
+// 每种操作都有阻塞、立即返回(try_)和限时(_for/_until)三种版本
+//
+// close()之后: 所有push都失败并返回false, 消费者仍然可以取走剩余的元素,
+// 队列取空后wait_and_pop不再阻塞而是返回false/nullptr; 阻塞中的线程都会被立刻唤醒,
+// 关闭流程不需要往队列里塞"结束"标记, 也不会有线程永远挂起
 template <typename T>
 class threadsafe_queue {
  private:
@@ -13,12 +27,52 @@ class threadsafe_queue {
             // 比如const成员函数empty()
   std::queue<T> data_queue;
   std::condition_variable data_cond;
+  std::condition_variable space_cond;  // 有界模式下等待队列有空位
+  size_t capacity_ = 0;
+  bool closed_ = false;
+
+  bool full() const { return capacity_ > 0 && data_queue.size() >= capacity_; }
+
+  // 以下辅助函数调用前都需要持有mut
+  template <typename... Args>
+  void push_locked(Args&&... args) {
+    data_queue.emplace(std::forward<Args>(args)...);
+    data_cond.notify_one();  // 唤醒等待数据的挂起线程
+  }
+
+  void pop_locked(T& value) {
+    value = std::move(data_queue.front());
+    data_queue.pop();
+    if (capacity_ > 0) {
+      space_cond.notify_one();  // 唤醒等待空位的生产者
+    }
+  }
+
+  std::shared_ptr<T> pop_shared_locked() {
+    std::shared_ptr<T> res = std::make_shared<T>(std::move(data_queue.front()));
+    data_queue.pop();
+    if (capacity_ > 0) {
+      space_cond.notify_one();
+    }
+    return res;
+  }
+
+  void wait_for_space(std::unique_lock<std::mutex>& lock) {
+    space_cond.wait(lock, [this]() { return closed_ || !full(); });
+  }
+
+  void wait_for_data(std::unique_lock<std::mutex>& lock) {
+    data_cond.wait(lock, [this]() { return closed_ || !data_queue.empty(); });
+  }
 
  public:
   threadsafe_queue() {}
+  explicit threadsafe_queue(size_t capacity) : capacity_(capacity) {}
   threadsafe_queue(const threadsafe_queue& other) {
     std::lock_guard<std::mutex> lock(other.mut);
     data_queue = other.data_queue;
+    capacity_ = other.capacity_;
+    closed_ = other.closed_;
   }
   threadsafe_queue& operator=(const threadsafe_queue&) = delete;
 
@@ -26,10 +80,83 @@ class threadsafe_queue {
     std::lock_guard<std::mutex> lock(mut);
     return data_queue.empty();
   }
-  void push(T new_value) {
+
+  size_t size() const {
     std::lock_guard<std::mutex> lock(mut);
-    data_queue.push(new_value);
-    data_cond.notify_one();  // 唤醒等待数据的挂起线程
+    return data_queue.size();
+  }
+
+  size_t capacity() const { return capacity_; }
+
+  // 关闭队列并唤醒所有阻塞的线程, 重复调用没有影响
+  void close() {
+    {
+      std::lock_guard<std::mutex> lock(mut);
+      closed_ = true;
+    }
+    data_cond.notify_all();
+    space_cond.notify_all();
+  }
+
+  bool closed() const {
+    std::lock_guard<std::mutex> lock(mut);
+    return closed_;
+  }
+
+  // 队列满时等待, 返回false表示队列已经关闭, 元素没有入队
+  bool push(T new_value) {
+    std::unique_lock<std::mutex> lock(mut);
+    wait_for_space(lock);
+    if (closed_) {
+      return false;
+    }
+    push_locked(std::move(new_value));
+    return true;
+  }
+
+  // 直接在队列中构造元素, 省去一次临时对象的移动
+  template <typename... Args>
+  bool emplace(Args&&... args) {
+    std::unique_lock<std::mutex> lock(mut);
+    wait_for_space(lock);
+    if (closed_) {
+      return false;
+    }
+    push_locked(std::forward<Args>(args)...);
+    return true;
+  }
+
+  // 队列满或已关闭时立即返回false; 只有入队成功时才会移动new_value,
+  // 失败后调用方仍然持有它, 可以稍后重试或者另行处理
+  template <typename U>
+  bool try_push(U&& new_value) {
+    std::lock_guard<std::mutex> lock(mut);
+    if (closed_ || full()) {
+      return false;
+    }
+    push_locked(std::forward<U>(new_value));
+    return true;
+  }
+
+  // 最多等到abs_time, 超时或队列已关闭时返回false
+  template <typename U, class Clock, class Duration>
+  bool try_push_until(U&& new_value,
+                      const std::chrono::time_point<Clock, Duration>& abs_time) {
+    std::unique_lock<std::mutex> lock(mut);
+    if (!space_cond.wait_until(lock, abs_time,
+                               [this]() { return closed_ || !full(); }) ||
+        closed_) {
+      return false;
+    }
+    push_locked(std::forward<U>(new_value));
+    return true;
+  }
+
+  template <typename U, class Rep, class Period>
+  bool try_push_for(U&& new_value,
+                    const std::chrono::duration<Rep, Period>& rel_time) {
+    return try_push_until(std::forward<U>(new_value),
+                          std::chrono::steady_clock::now() + rel_time);
   }
 
   bool try_pop(T& value) {
@@ -37,8 +164,7 @@ class threadsafe_queue {
     if (data_queue.empty()) {
       return false;
     }
-    value = data_queue.front();
-    data_queue.pop();
+    pop_locked(value);
     return true;
   }
 
@@ -47,27 +173,80 @@ class threadsafe_queue {
     if (data_queue.empty()) {
       return std::shared_ptr<T>();
     }
-    std::shared_ptr<T> res = std::make_shared<T>(data_queue.front());
-    data_queue.pop();
-    return res;
+    return pop_shared_locked();
   }
 
-  void wait_and_pop(T& value) {
+  // 队列已关闭且已取空时返回false
+  bool wait_and_pop(T& value) {
     std::unique_lock<std::mutex> lock(mut);
-    data_cond.wait(lock, [this]() { return !data_queue.empty(); });
-    value = data_queue.front();  // 使用引用传output param, 避免拷贝
-    data_queue.pop();
+    wait_for_data(lock);
+    if (data_queue.empty()) {
+      return false;
+    }
+    pop_locked(value);  // 使用引用传output param, 避免拷贝
+    return true;
   }
 
+  // 队列已关闭且已取空时返回nullptr
   std::shared_ptr<T> wait_and_pop() {
     std::unique_lock<std::mutex> lock(mut);
-    data_cond.wait(lock, [this]() { return !data_queue.empty(); });
-    std::shared_ptr<T> res = std::make_shared<T>(data_queue.front());
-    data_queue.pop();
-    return res;  
+    wait_for_data(lock);
+    if (data_queue.empty()) {
+      return std::shared_ptr<T>();
+    }
+    std::shared_ptr<T> res = pop_shared_locked();
+    return res;
     // 返回一个局部的智能指针是安全的, 创建智能指针时, 其引用计数加1为1,
-    // 外部调用函数时会将返回的智能指针赋值给外部变量, 做一次拷贝, 引用计数加1为2, 
+    // 外部调用函数时会将返回的智能指针赋值给外部变量, 做一次拷贝, 引用计数加1为2,
     // 当离开作用域时,销毁局部的智能指针, 引用计数减1为1, 其所指向的对象仍是安全的
   }
+
+  // 最多等到abs_time, 超时或队列已关闭且已取空时返回false
+  template <class Clock, class Duration>
+  bool try_pop_until(T& value,
+                     const std::chrono::time_point<Clock, Duration>& abs_time) {
+    std::unique_lock<std::mutex> lock(mut);
+    data_cond.wait_until(lock, abs_time, [this]() {
+      return closed_ || !data_queue.empty();
+    });
+    if (data_queue.empty()) {
+      return false;
+    }
+    pop_locked(value);
+    return true;
+  }
+
+  template <class Rep, class Period>
+  bool try_pop_for(T& value,
+                   const std::chrono::duration<Rep, Period>& rel_time) {
+    return try_pop_until(value, std::chrono::steady_clock::now() + rel_time);
+  }
+
+  // 一次加锁取出队列中的所有元素, 队列为空时返回空队列
+  // 只交换内部的std::queue, 持锁时间与元素个数无关
+  std::queue<T> pop_all() {
+    std::queue<T> res;
+    {
+      std::lock_guard<std::mutex> lock(mut);
+      res.swap(data_queue);
+    }
+    if (capacity_ > 0 && !res.empty()) {
+      space_cond.notify_all();
+    }
+    return res;
+  }
+
+  // 取出所有元素并依次移动到out的末尾(out需要支持push_back), 返回取出的元素个数
+  // 消费者批量处理时每批只加一次锁, 移动元素在锁外进行
+  template <typename Container>
+  size_t drain_into(Container& out) {
+    std::queue<T> items = pop_all();
+    size_t n = items.size();
+    while (!items.empty()) {
+      out.push_back(std::move(items.front()));
+      items.pop();
+    }
+    return n;
+  }
 };
-#endif  // threadsafe_queue_h_
\ No newline at end of file
+#endif  // threadsafe_queue_h_
@@ -0,0 +1,437 @@
+#ifndef timer_wheel_h_
+#define timer_wheel_h_
+#include <algorithm>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "function_wrapper.h"
+
+#ifdef __linux__
+#include <pthread.h>
+#endif
+
+// 分层时间轮(hierarchical timing wheel), 参考Linux内核的定时器实现
+// 用优先队列(堆)保存定时器时, 插入和删除都是O(log n); 时间轮把时间按tick分成槽位,
+// 定时器直接挂到到期时间对应槽位的链表上, 插入和取消都是O(1):
+// 1. 共kLevelNum层, 每层kSlotNum个槽位; 第0层每个槽位是1个tick,
+//    第l层每个槽位覆盖kSlotNum^l个tick, 4层 * 256个槽位可以表示2^32个tick
+// 2. 距离到期还有delta个tick的定时器放在能容纳delta的最低一层
+// 3. 时间每走到第l层一个槽位的起点, 就把这个槽位上的定时器重新插入(cascade),
+//    它们会落到更低的层, 最终在第0层的槽位上到期
+// 定时器节点统一存放在一个数组中, 链表用下标相连, 释放的节点通过空闲链表复用;
+// TimerId中带有节点的代数(generation), 节点复用后旧的TimerId自然失效
+// TimerWheel本身不加锁, 由TimerService在自己的互斥锁保护下使用
+class TimerWheel {
+ public:
+  static constexpr int kLevelBits = 8;
+  static constexpr int kSlotNum = 1 << kLevelBits;  // 256
+  static constexpr int kLevelNum = 4;
+  static constexpr uint64_t kSlotMask = kSlotNum - 1;
+  static constexpr uint64_t kMaxDelta =
+      (uint64_t(1) << (kLevelBits * kLevelNum)) - 1;
+  static constexpr uint64_t kNever = UINT64_MAX;
+
+  struct TimerId {
+    uint32_t index = UINT32_MAX;
+    uint32_t generation = 0;
+  };
+
+  TimerWheel() {
+    for (auto& level : heads_) {
+      std::fill(std::begin(level), std::end(level), kNil);
+    }
+  }
+
+  // 在第expire个tick到期, period不为0时每隔period个tick重复一次
+  // 已经过去的expire按当前tick处理, 在下一次Advance时到期
+  TimerId Add(uint64_t expire, function_wrapper task, uint64_t period = 0) {
+    uint32_t index = Allocate();
+    Node& node = nodes_[index];
+    node.expire = std::max(expire, current_);
+    node.period = period;
+    if (period == 0) {
+      node.task = std::move(task);
+    } else {
+      node.repeat = std::make_shared<function_wrapper>(std::move(task));
+    }
+    Link(index);
+    ++size_;
+    return TimerId{index, node.generation};
+  }
+
+  // 定时器已经到期(一次性的)或者已经被取消时返回false
+  bool Cancel(TimerId id) {
+    if (id.index >= nodes_.size() ||
+        nodes_[id.index].generation != id.generation ||
+        !nodes_[id.index].linked) {
+      return false;
+    }
+    Unlink(id.index);
+    Free(id.index);
+    --size_;
+    return true;
+  }
+
+  // 处理到第now个tick(包含)为止到期的定时器, 把要执行的任务放入expired
+  // 没有事件的tick直接跳过, 长时间没有调用也不会逐个tick空转
+  void Advance(uint64_t now, std::vector<function_wrapper>& expired) {
+    while (current_ <= now) {
+      uint64_t next = NextTick();
+      if (next > now) {
+        current_ = now + 1;
+        return;
+      }
+      current_ = next;
+      if ((current_ & kSlotMask) == 0) {
+        for (int level = 1; level < kLevelNum; ++level) {
+          int slot = SlotOf(current_, level);
+          Cascade(level, slot);
+          if (slot != 0) {
+            break;
+          }
+        }
+      }
+      Fire(SlotOf(current_, 0), now, expired);
+      ++current_;
+    }
+  }
+
+  // 不小于当前tick的、下一个需要处理的tick(第0层有定时器到期, 或者要cascade上层的槽位),
+  // 没有定时器时返回kNever
+  uint64_t NextTick() const {
+    if (size_ == 0) {
+      return kNever;
+    }
+    uint64_t next = kNever;
+    if (counts_[0] > 0) {
+      next = current_ + NextSlotDistance(SlotOf(current_, 0));
+    }
+    for (int level = 1; level < kLevelNum; ++level) {
+      if (counts_[level] == 0) {
+        continue;
+      }
+      int shift = kLevelBits * level;
+      uint64_t low_mask = (uint64_t(1) << shift) - 1;
+      uint64_t boundary = (current_ & low_mask) == 0
+                              ? current_
+                              : ((current_ >> shift) + 1) << shift;
+      next = std::min(next, boundary);
+    }
+    return next;
+  }
+
+  // 取出所有还没到期的定时器的任务, 用于关闭时取消它们
+  std::vector<function_wrapper> Clear() {
+    std::vector<function_wrapper> tasks;
+    for (uint32_t i = 0; i < nodes_.size(); ++i) {
+      if (nodes_[i].linked) {
+        Unlink(i);
+        if (nodes_[i].period == 0) {
+          tasks.push_back(std::move(nodes_[i].task));
+        }
+        Free(i);
+      }
+    }
+    size_ = 0;
+    return tasks;
+  }
+
+  size_t Size() const { return size_; }
+  uint64_t CurrentTick() const { return current_; }
+
+ private:
+  static constexpr uint32_t kNil = UINT32_MAX;
+
+  struct Node {
+    function_wrapper task;  // 一次性定时器的任务
+    // 周期定时器的任务, 每次到期时提交一个引用它的任务, 所以要共享
+    std::shared_ptr<function_wrapper> repeat;
+    uint64_t expire = 0;
+    uint64_t period = 0;
+    uint32_t generation = 0;
+    uint32_t prev = kNil;
+    uint32_t next = kNil;  // 空闲节点用它串成空闲链表
+    uint8_t level = 0;
+    uint8_t slot = 0;
+    bool linked = false;
+  };
+
+  static int SlotOf(uint64_t tick, int level) {
+    return static_cast<int>((tick >> (kLevelBits * level)) & kSlotMask);
+  }
+
+  uint32_t Allocate() {
+    if (free_head_ != kNil) {
+      uint32_t index = free_head_;
+      free_head_ = nodes_[index].next;
+      return index;
+    }
+    nodes_.emplace_back();
+    return static_cast<uint32_t>(nodes_.size() - 1);
+  }
+
+  void Free(uint32_t index) {
+    Node& node = nodes_[index];
+    node.task = function_wrapper();
+    node.repeat.reset();
+    ++node.generation;
+    node.next = free_head_;
+    free_head_ = index;
+  }
+
+  // 按剩余的tick数选择层, 超出表示范围的放在最高层, cascade时再重新选择
+  void Link(uint32_t index) {
+    Node& node = nodes_[index];
+    uint64_t delta = node.expire - current_;
+    uint64_t expire = node.expire;
+    if (delta > kMaxDelta) {
+      expire = current_ + kMaxDelta;
+      delta = kMaxDelta;
+    }
+    int level = 0;
+    while (level < kLevelNum - 1 &&
+           delta >= (uint64_t(1) << (kLevelBits * (level + 1)))) {
+      ++level;
+    }
+    int slot = SlotOf(expire, level);
+    node.level = static_cast<uint8_t>(level);
+    node.slot = static_cast<uint8_t>(slot);
+    node.prev = kNil;
+    node.next = heads_[level][slot];
+    if (node.next != kNil) {
+      nodes_[node.next].prev = index;
+    }
+    heads_[level][slot] = index;
+    node.linked = true;
+    ++counts_[level];
+    if (level == 0) {
+      bitmap_[slot / 64] |= uint64_t(1) << (slot % 64);
+    }
+  }
+
+  void Unlink(uint32_t index) {
+    Node& node = nodes_[index];
+    if (node.prev != kNil) {
+      nodes_[node.prev].next = node.next;
+    } else {
+      heads_[node.level][node.slot] = node.next;
+    }
+    if (node.next != kNil) {
+      nodes_[node.next].prev = node.prev;
+    }
+    node.linked = false;
+    --counts_[node.level];
+    if (node.level == 0 && heads_[0][node.slot] == kNil) {
+      bitmap_[node.slot / 64] &= ~(uint64_t(1) << (node.slot % 64));
+    }
+  }
+
+  // 摘下整个槽位的链表, 返回链表头
+  uint32_t Detach(int level, int slot) {
+    uint32_t head = heads_[level][slot];
+    heads_[level][slot] = kNil;
+    for (uint32_t i = head; i != kNil; i = nodes_[i].next) {
+      nodes_[i].linked = false;
+      --counts_[level];
+    }
+    if (level == 0) {
+      bitmap_[slot / 64] &= ~(uint64_t(1) << (slot % 64));
+    }
+    return head;
+  }
+
+  void Cascade(int level, int slot) {
+    uint32_t i = Detach(level, slot);
+    while (i != kNil) {
+      uint32_t next = nodes_[i].next;
+      Link(i);
+      i = next;
+    }
+  }
+
+  // 第0层槽位上的定时器到期: 一次性的交出任务并释放节点, 周期性的重新插入
+  // now是这次Advance要处理到的tick, 周期定时器重新插入到now之后, 否则同一次Advance
+  // 还会再走到它, 落后的每个周期都会被补发一次
+  void Fire(int slot, uint64_t now, std::vector<function_wrapper>& expired) {
+    uint32_t i = Detach(0, slot);
+    while (i != kNil) {
+      Node& node = nodes_[i];
+      uint32_t next = node.next;
+      if (node.period == 0) {
+        expired.push_back(std::move(node.task));
+        Free(i);
+        --size_;
+      } else {
+        expired.emplace_back([repeat = node.repeat]() { (*repeat)(); });
+        // 处理不及时错过的周期直接跳过, 只执行一次, 下一次对齐到now之后的第一个周期
+        node.expire += node.period;
+        if (node.expire <= now) {
+          node.expire += ((now - node.expire) / node.period + 1) * node.period;
+        }
+        Link(i);
+      }
+      i = next;
+    }
+  }
+
+  // 从第start个槽位开始(包含), 到第0层下一个非空槽位的距离
+  int NextSlotDistance(int start) const {
+    for (int d = 0; d < kSlotNum;) {
+      int slot = (start + d) & static_cast<int>(kSlotMask);
+      uint64_t word = bitmap_[slot / 64] >> (slot % 64);
+      if (word != 0) {
+        return d + LowestBit(word);
+      }
+      d += 64 - slot % 64;
+    }
+    return kSlotNum;
+  }
+
+  static int LowestBit(uint64_t v) {
+#if defined(__GNUC__)
+    return __builtin_ctzll(v);
+#else
+    int bit = 0;
+    while ((v & 1) == 0) {
+      v >>= 1;
+      ++bit;
+    }
+    return bit;
+#endif
+  }
+
+  std::vector<Node> nodes_;
+  uint32_t free_head_ = kNil;
+  uint32_t heads_[kLevelNum][kSlotNum];
+  size_t counts_[kLevelNum] = {};
+  uint64_t bitmap_[kSlotNum / 64] = {};  // 第0层哪些槽位非空
+  uint64_t current_ = 0;  // 下一个要处理的tick, 之前的tick都已处理
+  size_t size_ = 0;
+};
+
+// 一个定时器线程驱动的时间轮, 到期的任务交给dispatch(比如提交给线程池)执行,
+// 定时器线程自己不执行任务, 任务耗时再长也不会影响其他定时器的精度
+// 定时器线程只在下一个有事件的tick醒来, 没有定时器时一直挂起
+class TimerService {
+ public:
+  using Clock = std::chrono::steady_clock;
+  using TimerId = TimerWheel::TimerId;
+  using Dispatch = std::function<void(function_wrapper)>;
+
+  TimerService(std::chrono::nanoseconds tick, Dispatch dispatch,
+               const std::string& name)
+      : tick_(std::max(tick, std::chrono::nanoseconds(1))),
+        start_(Clock::now()),
+        dispatch_(std::move(dispatch)) {
+    td_ = std::thread([this]() { Run(); });
+#ifdef __linux__
+    std::string thread_name = name.substr(0, 15);
+    pthread_setname_np(td_.native_handle(), thread_name.c_str());
+#else
+    (void)name;
+#endif
+  }
+
+  TimerService(const TimerService&) = delete;
+  TimerService& operator=(const TimerService&) = delete;
+  ~TimerService() { Stop(); }
+
+  // 到期时间向上取整到tick, 定时器不会提前到期
+  TimerId Add(Clock::time_point when, function_wrapper task,
+              std::chrono::nanoseconds period = std::chrono::nanoseconds(0)) {
+    uint64_t expire = CeilTicks(when - start_);
+    uint64_t period_ticks = 0;
+    if (period.count() > 0) {
+      period_ticks = std::max<uint64_t>(CeilTicks(period), 1);
+    }
+    std::lock_guard<std::mutex> lock(mtx_);
+    TimerId id = wheel_.Add(expire, std::move(task), period_ticks);
+    // 定时器线程挂起时等待的时间点比新定时器晚, 唤醒它重新计算
+    if (expire < wake_tick_) {
+      wake_tick_ = expire;
+      cv_.notify_one();
+    }
+    return id;
+  }
+
+  bool Cancel(TimerId id) {
+    std::lock_guard<std::mutex> lock(mtx_);
+    return wheel_.Cancel(id);
+  }
+
+  size_t Size() {
+    std::lock_guard<std::mutex> lock(mtx_);
+    return wheel_.Size();
+  }
+
+  // 停止定时器线程, 返回还没到期的一次性任务, 由调用者决定如何处理; 可以重复调用
+  std::vector<function_wrapper> Stop() {
+    {
+      std::lock_guard<std::mutex> lock(mtx_);
+      stop_ = true;
+    }
+    cv_.notify_one();
+    if (td_.joinable()) {
+      td_.join();
+    }
+    std::lock_guard<std::mutex> lock(mtx_);
+    return wheel_.Clear();
+  }
+
+ private:
+  uint64_t CeilTicks(std::chrono::nanoseconds d) const {
+    if (d.count() <= 0) {
+      return 0;
+    }
+    return static_cast<uint64_t>((d - std::chrono::nanoseconds(1)) / tick_) + 1;
+  }
+
+  uint64_t NowTick() const {
+    return static_cast<uint64_t>((Clock::now() - start_) / tick_);
+  }
+
+  void Run() {
+    std::vector<function_wrapper> expired;
+    std::unique_lock<std::mutex> lock(mtx_);
+    while (!stop_) {
+      wheel_.Advance(NowTick(), expired);
+      if (!expired.empty()) {
+        // 提交任务时不持有锁, 其他线程可以同时添加、取消定时器
+        lock.unlock();
+        for (auto& task : expired) {
+          dispatch_(std::move(task));
+        }
+        expired.clear();
+        lock.lock();
+        continue;
+      }
+      wake_tick_ = wheel_.NextTick();
+      if (wake_tick_ == TimerWheel::kNever) {
+        cv_.wait(lock);
+      } else {
+        cv_.wait_until(lock, start_ + wake_tick_ * tick_);
+      }
+      wake_tick_ = 0;
+    }
+  }
+
+  const std::chrono::nanoseconds tick_;
+  const Clock::time_point start_;
+  Dispatch dispatch_;
+  std::mutex mtx_;
+  std::condition_variable cv_;
+  TimerWheel wheel_;
+  bool stop_ = false;
+  // 定时器线程挂起时等到的tick, 运行时为0, 此时不需要唤醒它
+  uint64_t wake_tick_ = 0;
+  std::thread td_;
+};
+
+#endif  // timer_wheel_h_
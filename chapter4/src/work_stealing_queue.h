@@ -0,0 +1,64 @@
+#ifndef work_stealing_queue_h_
+#define work_stealing_queue_h_
+#include <deque>
+#include <mutex>
+
+// 工作窃取队列: 线程池中每个工作线程都持有一个自己的队列
+// 1. 工作线程自己从队列前端push/pop, 后进先出(LIFO), 刚提交的任务数据大概率还在缓存中
+// 2. 其他空闲线程从队列后端窃取(steal), 先进先出(FIFO), 窃取到的通常是较大的任务块,
+//    比如递归分治时最先拆分出来的那一半
+// 每个队列各有一把锁, 只有窃取时才会和队列的所有者竞争, 不会所有线程都争抢同一把锁
+template <typename T>
+class work_stealing_queue {
+ private:
+  std::deque<T> the_queue;
+  mutable std::mutex the_mutex;
+
+ public:
+  work_stealing_queue() {}
+  work_stealing_queue(const work_stealing_queue&) = delete;
+  work_stealing_queue& operator=(const work_stealing_queue&) = delete;
+
+  void push(T data) {
+    std::lock_guard<std::mutex> lock(the_mutex);
+    the_queue.push_front(std::move(data));
+  }
+
+  // 批量插入, 只加一次锁; 元素会被移走
+  template <typename Iterator>
+  void push(Iterator first, Iterator last) {
+    std::lock_guard<std::mutex> lock(the_mutex);
+    for (; first != last; ++first) {
+      the_queue.push_front(std::move(*first));
+    }
+  }
+
+  bool empty() const {
+    std::lock_guard<std::mutex> lock(the_mutex);
+    return the_queue.empty();
+  }
+
+  // 所有者线程从前端取任务
+  bool try_pop(T& res) {
+    std::lock_guard<std::mutex> lock(the_mutex);
+    if (the_queue.empty()) {
+      return false;
+    }
+    res = std::move(the_queue.front());
+    the_queue.pop_front();
+    return true;
+  }
+
+  // 其他线程从后端窃取任务
+  bool try_steal(T& res) {
+    std::lock_guard<std::mutex> lock(the_mutex);
+    if (the_queue.empty()) {
+      return false;
+    }
+    res = std::move(the_queue.back());
+    the_queue.pop_back();
+    return true;
+  }
+};
+
+#endif  // work_stealing_queue_h_
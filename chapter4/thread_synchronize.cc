@@ -1,14 +1,22 @@
 #include <condition_variable>
 #include <iostream>
 #include <mutex>
+#include <numeric>
 #include <queue>
 #include <thread>
 
 #include "threadsafe_queue.h"
+#include "spsc_ring_buffer.h"
 #include "future_sample.h"
 #include "thread_pool.h"
+#include "pool_future.h"
+#include "task_group.h"
+#include "parallel_algorithm.h"
+#include "strand.h"
 #include "parallel_quick_sort.h"
 #include "csp_sample.h"
+#include "thread_pool_bench.h"
+#include "queue_bench.h"
 // 1. C++标准提供了两种条件变量:
 // std::condition_variable 和 std::condition_variable_any
 std::mutex mtx;
@@ -46,6 +54,40 @@ void TestCondSample() {
   t2.join();
 }
 
+// 同样的生产者/消费者, 只有一个生产者和一个消费者时可以换成无锁的spsc_ring_buffer,
+// 传递数据不需要加锁和唤醒; 代价是队列空或满时只能自旋等待
+void TestSpscSample() {
+  spsc_ring_buffer<int> ring(16);
+  std::thread t1([&ring]() {
+    int num = 10;
+    while (num--) {
+      int i = num;  // prepare data sample
+      while (!ring.try_push(i)) {
+        std::this_thread::yield();
+      }
+    }
+  });
+  std::thread t2([&ring]() {
+    int data[4];
+    for (;;) {
+      size_t n = ring.pop_n(data, 4);  // 一次取走已经准备好的所有数据(最多4个)
+      if (n == 0) {
+        std::this_thread::yield();
+        continue;
+      }
+      for (size_t i = 0; i < n; ++i) {
+        std::cout << "process data sample: " << data[i] << std::endl;
+      }
+      if (data[n - 1] == 0) {  // last data chunk
+        break;
+      }
+    }
+  });
+
+  t1.join();
+  t2.join();
+}
+
 // 2. 使用条件变量的例子: 两个线程交替打印1和2
 int num = 1;
 std::mutex num_mtx;
@@ -135,6 +177,63 @@ void TestSafeQueue() {
   constumer2.join();
 }
 
+// 队列中存放只能移动的大消息, 入队出队都只移动指针, 消费者每次批量取走所有消息
+void TestSafeQueueMoveOnly() {
+  threadsafe_queue<std::unique_ptr<std::vector<char>>> safe_queue;
+  std::thread producer([&]() {
+    for (int i = 0; i < 100; ++i) {
+      safe_queue.push(std::make_unique<std::vector<char>>(1 << 20, 'a'));
+    }
+    safe_queue.emplace(nullptr);  // 空指针表示结束
+  });
+
+  size_t bytes = 0;
+  bool finished = false;
+  std::vector<std::unique_ptr<std::vector<char>>> batch;
+  while (!finished) {
+    std::unique_ptr<std::vector<char>> first;
+    safe_queue.wait_and_pop(first);
+    batch.push_back(std::move(first));
+    safe_queue.drain_into(batch);
+    for (auto& buffer : batch) {
+      if (buffer == nullptr) {
+        finished = true;
+      } else {
+        bytes += buffer->size();
+      }
+    }
+    batch.clear();
+  }
+  producer.join();
+  std::cout << "consumed " << bytes << " bytes" << std::endl;
+}
+
+// 有界队列: 消费者比生产者慢时, 生产者在队列满时被阻塞, 队列中最多只有8个元素;
+// 生产结束后close(), 消费者取完剩余的元素后wait_and_pop返回false, 自然退出
+void TestBoundedSafeQueue() {
+  threadsafe_queue<int> safe_queue(8);
+  std::thread consumer([&]() {
+    int value;
+    int count = 0;
+    while (safe_queue.wait_and_pop(value)) {
+      std::this_thread::sleep_for(std::chrono::milliseconds(1));
+      count++;
+    }
+    std::cout << "consumer got " << count << " items" << std::endl;
+  });
+
+  int dropped = 0;
+  for (int i = 0; i < 200; ++i) {
+    // 最多等待5ms, 消费者跟不上时丢弃这个元素, 而不是无限期地阻塞生产者
+    if (!safe_queue.try_push_for(i, std::chrono::milliseconds(5))) {
+      dropped++;
+    }
+  }
+  safe_queue.close();
+  consumer.join();
+  std::cout << "producer dropped " << dropped << " items" << std::endl;
+}
+
 // 线程池使用示例
 void use_thread_pool_false() {
   int m = 0;
@@ -170,11 +269,356 @@ void use_thread_pool() {
   std::cout << "m address is " << &m << std::endl;
 }
 
+// 创建独立的线程池: 延迟敏感的任务和批处理任务各用一个线程池, 并绑定到不同的CPU上
+void use_thread_pool_options() {
+  unsigned int cores = std::thread::hardware_concurrency();
+  ThreadPoolOptions latency_options;
+  latency_options.thread_num = 1;
+  latency_options.cpu_affinity = {0};
+  latency_options.name_prefix = "latency";
+  ThreadPool latency_pool(latency_options);
+
+  ThreadPoolOptions batch_options;
+  batch_options.thread_num = cores > 1 ? cores - 1 : 1;
+  for (unsigned int cpu = 1; cpu < cores; ++cpu) {
+    batch_options.cpu_affinity.push_back(cpu);
+  }
+  batch_options.name_prefix = "batch";
+  ThreadPool batch_pool(batch_options);
+
+  auto latency = latency_pool.Commit([]() { return 1; });
+  auto batch = batch_pool.Commit([]() { return 2; });
+  std::cout << "latency pool result " << latency.get() << ", batch pool result "
+            << batch.get() << std::endl;
+}
+
+// 弹性线程池: 平时只保留2个线程, 突发流量时最多扩到8个, 空闲1秒后缩回2个
+void use_elastic_thread_pool() {
+  ThreadPoolOptions options;
+  options.thread_num = 2;
+  options.elastic = true;
+  options.max_thread_num = 8;
+  options.keep_alive = std::chrono::seconds(1);
+  ThreadPool pool(options);
+
+  std::vector<std::future<void>> futures;
+  for (int i = 0; i < 32; ++i) {
+    futures.push_back(pool.Commit(
+        []() { std::this_thread::sleep_for(std::chrono::milliseconds(50)); }));
+  }
+  std::cout << "threads during burst: " << pool.ThreadCount() << std::endl;
+  for (auto& fut : futures) {
+    fut.get();
+  }
+  std::this_thread::sleep_for(std::chrono::seconds(2));
+  std::cout << "threads after idle: " << pool.ThreadCount() << std::endl;
+}
+
+// 线程池的统计数据: 提交/完成的任务数, 队列深度, 排队时间和执行时间的分布等
+void use_thread_pool_metrics() {
+  ThreadPool pool(2);
+  std::vector<std::future<int>> futures;
+  for (int i = 0; i < 100; ++i) {
+    futures.push_back(pool.Commit([](int x) { return x * x; }, i));
+  }
+  for (auto& fut : futures) {
+    fut.get();
+  }
+  ThreadPoolMetrics metrics = pool.Metrics();
+  std::cout << "completed " << metrics.tasks_completed << ", wait p99 "
+            << metrics.wait_time.Percentile(99) << "ns" << std::endl;
+  std::cout << pool.DumpMetrics();
+}
+
+// 关闭线程池: 最多等待100ms让队列中的任务执行完, 超时后剩余的任务被取消,
+// 被取消任务的future中保存TaskCancelled异常
+void use_thread_pool_shutdown() {
+  ThreadPool pool(2);
+  std::vector<std::future<int>> futures;
+  for (int i = 0; i < 100; ++i) {
+    futures.push_back(pool.Commit([i]() {
+      std::this_thread::sleep_for(std::chrono::milliseconds(10));
+      return i;
+    }));
+  }
+  bool drained = pool.ShutdownFor(std::chrono::milliseconds(100));
+  int done = 0;
+  int cancelled = 0;
+  for (auto& fut : futures) {
+    try {
+      fut.get();
+      ++done;
+    } catch (const TaskCancelled&) {
+      ++cancelled;
+    }
+  }
+  std::cout << "drained " << drained << ", done " << done << ", cancelled "
+            << cancelled << std::endl;
+}
+
+// 客户端请求超时后取消为它排队的任务, 正在执行的任务检查到取消后提前返回
+void use_task_cancellation() {
+  ThreadPool pool(2);
+  CancellationSource request;
+  TaskOptions task_options;
+  task_options.token = request.Token();
+  task_options.deadline =
+      std::chrono::steady_clock::now() + std::chrono::milliseconds(100);
+  std::vector<std::future<int>> futures;
+  for (int i = 0; i < 20; ++i) {
+    futures.push_back(pool.Commit(task_options, [i]() {
+      for (int step = 0; step < 10; ++step) {
+        if (ThreadPool::CancellationRequested()) {
+          return -1;
+        }
+        std::this_thread::sleep_for(std::chrono::milliseconds(5));
+      }
+      return i;
+    }));
+  }
+  std::this_thread::sleep_for(std::chrono::milliseconds(120));
+  request.Cancel();
+  int done = 0;
+  int aborted = 0;
+  int skipped = 0;
+  for (auto& fut : futures) {
+    try {
+      (fut.get() < 0 ? aborted : done)++;
+    } catch (const TaskCancelled&) {
+      ++skipped;
+    }
+  }
+  std::cout << "done " << done << ", aborted " << aborted << ", skipped "
+            << skipped << std::endl;
+}
+
+// 延迟和周期任务由定时器线程在到期时提交给线程池, 等待期间不占用工作线程
+void use_thread_pool_timer() {
+  ThreadPool pool(2);
+  auto start = std::chrono::steady_clock::now();
+  auto elapsed_ms = [start]() {
+    return std::chrono::duration_cast<std::chrono::milliseconds>(
+               std::chrono::steady_clock::now() - start)
+        .count();
+  };
+  pool.ScheduleAfter(std::chrono::milliseconds(50), [elapsed_ms]() {
+    std::cout << "delayed task at " << elapsed_ms() << "ms" << std::endl;
+  });
+  auto heartbeat =
+      pool.ScheduleEvery(std::chrono::milliseconds(30), [elapsed_ms]() {
+        std::cout << "heartbeat at " << elapsed_ms() << "ms" << std::endl;
+      });
+  auto timeout = pool.ScheduleAfter(std::chrono::milliseconds(80), []() {
+    std::cout << "request timed out" << std::endl;
+  });
+  // 请求在超时前完成, 取消超时处理
+  pool.CancelTimer(timeout);
+  std::this_thread::sleep_for(std::chrono::milliseconds(100));
+  pool.CancelTimer(heartbeat);
+}
+
+// 直接驱动时间轮: 周期为1个tick的定时器在第10个tick第一次到期,
+// 一直没有处理, 直到第1000个tick才Advance, 错过的周期只执行一次, 不会集中补发
+void use_timer_wheel() {
+  TimerWheel wheel;
+  int fired = 0;
+  wheel.Add(10, function_wrapper([&fired]() { ++fired; }), 1);
+  std::vector<function_wrapper> expired;
+  wheel.Advance(1000, expired);
+  for (auto& task : expired) {
+    task();
+  }
+  std::cout << "fired " << fired << " time(s) after lagging 990 periods, "
+            << "next tick " << wheel.NextTick() << std::endl;
+  expired.clear();
+  wheel.Advance(1001, expired);
+  std::cout << "fired " << expired.size() << " time(s) at tick 1001"
+            << std::endl;
+}
+
+// 用TaskGroup实现parallel_accumulate: 每个块的结果写到各自的位置, 只需要一次Wait
+void use_task_group() {
+  std::vector<int> nums(1000000, 1);
+  const size_t block_size = 10000;
+  const size_t block_num = (nums.size() + block_size - 1) / block_size;
+  std::vector<long long> sums(block_num, 0);
+  TaskGroup group;
+  for (size_t i = 0; i < block_num; ++i) {
+    group.Run([&nums, &sums, i, block_size]() {
+      auto first = nums.begin() + i * block_size;
+      auto last = nums.begin() + std::min(nums.size(), (i + 1) * block_size);
+      sums[i] = std::accumulate(first, last, 0LL);
+    });
+  }
+  group.Wait();
+  std::cout << "sum is " << std::accumulate(sums.begin(), sums.end(), 0LL)
+            << std::endl;
+
+  // 子任务抛出的第一个异常在Wait中重新抛出
+  for (int i = 0; i < 10; ++i) {
+    group.Run([i]() {
+      if (i == 3) {
+        throw std::runtime_error("block 3 failed");
+      }
+    });
+  }
+  try {
+    group.Wait();
+  } catch (const std::exception& e) {
+    std::cout << "task group failed: " << e.what() << std::endl;
+  }
+}
+
+// 在线程池上并行地处理每个元素, 再归约求和
+void use_parallel_algorithm() {
+  std::vector<int> nums(100000);
+  parallel_for(0, static_cast<int>(nums.size()),
+               [&nums](int i) { nums[i] = i % 10; });
+  long long sum = parallel_reduce(nums.begin(), nums.end(), 0LL,
+                                  [](long long a, long long b) { return a + b; });
+  std::cout << "sum is " << sum << std::endl;
+}
+
+// 多阶段的fan-out/fan-in: 并行计算各段的平方和, 再汇总, 中间结果都不需要线程等待
+void use_pool_future() {
+  ThreadPool pool(4);
+  std::vector<pool_future<long long>> parts;
+  for (int i = 0; i < 8; ++i) {
+    parts.push_back(pool_async(pool, [i]() {
+      long long sum = 0;
+      for (long long n = i * 1000; n < (i + 1) * 1000; ++n) {
+        sum += n * n;
+      }
+      return sum;
+    }));
+  }
+  auto total = when_all(std::move(parts)).then([](std::vector<long long> sums) {
+    long long total = 0;
+    for (long long sum : sums) {
+      total += sum;
+    }
+    return total;
+  });
+
+  // 两个任务谁先完成就用谁的结果
+  std::vector<pool_future<int>> racers;
+  racers.push_back(pool_async(pool, []() {
+    std::this_thread::sleep_for(std::chrono::milliseconds(50));
+    return 1;
+  }));
+  racers.push_back(pool_async(pool, []() { return 2; }));
+  auto first = when_any(std::move(racers));
+
+  std::cout << "sum of squares " << total.get() << std::endl;
+  std::cout << "first finished " << first.get().second << std::endl;
+}
+
+// 混合负载: 阻塞的"数据库查询"交给阻塞线程池, 2个计算线程不会被它们占住,
+// 计算任务不需要排在查询后面等待
+void use_blocking_task() {
+  ThreadPool pool(2);
+  auto start = std::chrono::steady_clock::now();
+  std::vector<std::future<std::string>> queries;
+  for (int i = 0; i < 8; ++i) {
+    queries.push_back(pool.CommitBlocking([i]() {
+      std::this_thread::sleep_for(std::chrono::milliseconds(200));
+      return "Data: " + std::to_string(i);
+    }));
+  }
+  std::vector<std::future<long long>> sums;
+  for (int i = 0; i < 8; ++i) {
+    sums.push_back(pool.Commit([i]() {
+      long long sum = 0;
+      for (long long n = 0; n < 1000000; ++n) {
+        sum += n % (i + 2);
+      }
+      return sum;
+    }));
+  }
+  for (auto& f : sums) {
+    f.get();
+  }
+  std::chrono::duration<double, std::milli> compute_cost =
+      std::chrono::steady_clock::now() - start;
+  for (auto& f : queries) {
+    f.get();
+  }
+  std::chrono::duration<double, std::milli> total_cost =
+      std::chrono::steady_clock::now() - start;
+  std::cout << "compute done in " << compute_cost.count() << "ms, queries done in "
+            << total_cost.count() << "ms" << std::endl;
+}
+
+// 准入控制: 提交速度超过处理能力时, 队列长度超过上限的任务直接被拒绝,
+// 提交方马上就能知道结果, 而不是排在越来越长的队列后面等待
+void use_admission_control() {
+  ThreadPoolOptions options;
+  options.thread_num = 2;
+  options.overload_policy = OverloadPolicy::kReject;
+  options.max_queue_depth = 16;
+  options.target_queue_delay = std::chrono::milliseconds(5);
+  ThreadPool pool(options);
+  std::vector<std::future<int>> results;
+  for (int i = 0; i < 100; ++i) {
+    results.push_back(pool.Commit([i]() {
+      std::this_thread::sleep_for(std::chrono::milliseconds(10));
+      return i;
+    }));
+  }
+  int accepted = 0;
+  int rejected = 0;
+  for (auto& f : results) {
+    try {
+      f.get();
+      accepted++;
+    } catch (const TaskRejected&) {
+      rejected++;
+    }
+  }
+  std::cout << "accepted " << accepted << ", rejected " << rejected << std::endl;
+  std::cout << pool.DumpMetrics();
+}
+
+// 每个会话一个Strand: 1000个会话共用4个工作线程, 同一会话的消息按顺序处理,
+// 会话内的状态不需要加锁
+void use_strand() {
+  const int kSessions = 1000;
+  const int kMessages = 100;
+  ThreadPool pool(4);
+  std::vector<std::unique_ptr<Strand>> strands;
+  std::vector<int> last_seen(kSessions, -1);
+  std::atomic<int> out_of_order{0};
+  for (int i = 0; i < kSessions; ++i) {
+    strands.push_back(std::make_unique<Strand>(pool));
+  }
+  std::vector<std::future<void>> done;
+  for (int m = 0; m < kMessages; ++m) {
+    for (int s = 0; s < kSessions; ++s) {
+      strands[s]->Post([&last_seen, &out_of_order, s, m]() {
+        if (last_seen[s] != m - 1) {
+          out_of_order++;
+        }
+        last_seen[s] = m;
+      });
+    }
+  }
+  for (auto& strand : strands) {
+    done.push_back(strand->Commit([]() {}));
+  }
+  for (auto& f : done) {
+    f.get();
+  }
+  std::cout << "out of order messages: " << out_of_order << std::endl;
+}
+
 int main() {
   // 1. 条件变量示例
   // TestCondSample();
+  // TestSpscSample();
   // AlternatePrint();
   // TestSafeQueue();
+  // TestSafeQueueMoveOnly();
+  // TestBoundedSafeQueue();
 
   // 2. async, packaged_task, promise示例
   // use_async();
@@ -193,14 +637,41 @@ int main() {
   // 5. 线程池示例
   // use_thread_pool_false();
   // use_thread_pool();
+  // use_thread_pool_options();
+  // use_elastic_thread_pool();
+  // use_thread_pool_metrics();
+  // use_thread_pool_shutdown();
+  // use_task_cancellation();
+  // use_thread_pool_timer();
+  // use_timer_wheel();
+  // use_task_group();
+  // use_parallel_algorithm();
+  // use_pool_future();
+  // use_blocking_task();
+  // use_strand();
+  // use_admission_control();
 
   // 6. 并行版快速排序示例
   // test_sequential_sort();
   // test_parallel_sort();
   // test_thread_pool_sort();
+  // test_continuation_sort();
+  // test_task_group_sort();
 
   // 7. csp并发模式示例
   use_csp_sample();
 
+  // 8. 线程池性能测试
+  // bench_thread_pool_commit();
+  // bench_thread_pool_batch();
+  // bench_thread_pool_priority();
+  // bench_thread_pool_queue();
+  // bench_thread_pool_wakeup();
+  // bench_parallel_reduce();
+
+  // 9. 线程安全队列性能测试
+  // bench_threadsafe_queue();
+  // bench_spsc_queue();
+
   return 0;
 }
\ No newline at end of file